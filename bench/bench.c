@@ -0,0 +1,380 @@
+/***
+ *  Unix Programming - Project 2
+ *
+ *  Special two channel video player based on FFMPEG and SDL
+ *  Made by Yoav Saroya (304835887) & Amit Shmuel (305213621)
+ *
+ *  bench: microbenchmarks of the hot paths of libplayer, on pictures and
+ *  sound decoded from the clips given (see gen_media). The engine is
+ *  compiled in, so its static functions are measured as they are.
+ */
+
+#include "../libplayer.c"
+
+#define BENCH_TIME 500000	/* microseconds a benchmark runs at least */
+#define BENCH_FRAMES 25	/* pictures and sound frames kept per clip */
+#define BENCH_TILE_WIDTH 640	/* the default window */
+#define BENCH_TILE_HEIGHT 480
+#define BENCH_MAX_PRODUCERS 8
+
+typedef void (*bench_func)(void *arg, int n);
+
+/* what is decoded from a clip */
+typedef struct BenchClip {
+	const char      *name;
+	AVFrame         *pictures[BENCH_FRAMES];
+	int             nb_pictures;
+	AVFrame         *samples[BENCH_FRAMES];
+	int             nb_samples;
+	AVStream        *audio_st;
+	AVFormatContext *fmt;
+}BenchClip;
+
+typedef struct BenchArg {
+	BenchClip       *clip;
+	int             producers;	// queue: threads putting packets, up to BENCH_MAX_PRODUCERS
+	int             color_flag;	// color filter
+	ColorFilter     filter;
+	AVFrame         *dst;
+	struct SwsContext *sws;
+	int             width, height;	// tile_draw: the canvas
+	VideoState      *is;
+	int             size;	// synchronize_audio: bytes of samples
+	PlayerEngine    *engine;	// view_draw: the view, its buffers and scalers
+	VideoState      *view_channels[2];	// view_draw: the pictures shown
+}BenchArg;
+
+typedef struct QueueProducer {
+	PacketQueue     *queue;
+	int             count;
+}QueueProducer;
+
+/* Run 'fn' on batches twice as large until one takes BENCH_TIME, print
+   the time per operation of that batch. */
+static void bench_run(const char *name, bench_func fn, void *arg) {
+
+	int64_t start, elapsed;
+	int n = 1;
+
+	fn(arg, 1);	/* warm up: scalers, buffers, caches */
+	for(;;) {
+		start = av_gettime();
+		fn(arg, n);
+		elapsed = av_gettime() - start;
+		if(elapsed >= BENCH_TIME || n >= INT_MAX / 2)
+			break;
+		n *= 2;
+	}
+	printf("%-52s %12.1f ns/op %10d ops\n", name, elapsed * 1000.0 / n, n);
+}
+
+static void *queue_producer(void *arg) {
+
+	QueueProducer *p = arg;
+	AVPacket pkt;
+	int i;
+
+	/* packets without payload: what is measured is the queue itself, the
+	   list node, the lock and the signal */
+	av_init_packet(&pkt);
+	pkt.data = NULL;
+	pkt.size = 0;
+	for(i = 0; i < p->count; i++)
+		packet_queue_put(p->queue, &pkt);
+	return NULL;
+}
+
+/* 'producers' threads put, this thread gets, like the demuxer and a decoder */
+static void bench_queue(void *arg, int n) {
+
+	BenchArg *b = arg;
+	QueueProducer producers[BENCH_MAX_PRODUCERS];
+	pthread_t threads[BENCH_MAX_PRODUCERS];
+	PacketQueue queue;
+	AVPacket pkt;
+	int i;
+
+	packet_queue_init(&queue);
+	for(i = 0; i < b->producers; i++) {
+		producers[i].queue = &queue;
+		producers[i].count = (n + i) / b->producers;
+		pthread_create(&threads[i], NULL, queue_producer, &producers[i]);
+	}
+	for(i = 0; i < n; i++) {
+		packet_queue_get(&queue, &pkt, 1);
+		av_free_packet(&pkt);
+	}
+	for(i = 0; i < b->producers; i++)
+		pthread_join(threads[i], NULL);
+	packet_queue_destroy(&queue);
+}
+
+static void bench_color_filter(void *arg, int n) {
+
+	BenchArg *b = arg;
+	int i;
+
+	for(i = 0; i < n; i++)
+		color_filter_run(&b->filter, b->clip->pictures[i % b->clip->nb_pictures], b->dst, b->color_flag);
+}
+
+/* the canvas renderer's path from a decoded picture to the screen */
+static void bench_tile_draw(void *arg, int n) {
+
+	BenchArg *b = arg;
+	SDL_Rect rect = { 0, 0, b->width, b->height };
+	int i;
+
+	for(i = 0; i < n; i++)
+		tile_draw(&b->sws, b->clip->pictures[i % b->clip->nb_pictures], &rect, 0,
+				b->dst->data, b->dst->linesize, b->width, b->height);
+}
+
+/* a comparison view of two pictures of the clip, composed like the canvas does */
+static void bench_view(void *arg, int n) {
+
+	BenchArg *b = arg;
+	SDL_Rect rect = { 0, 0, b->width, b->height };
+	VideoState *a = b->view_channels[0], *s = b->view_channels[1];
+	int i;
+
+	for(i = 0; i < n; i++) {
+		av_frame_unref(a->shown_frame);
+		av_frame_unref(s->shown_frame);
+		av_frame_ref(a->shown_frame, b->clip->pictures[i % b->clip->nb_pictures]);
+		av_frame_ref(s->shown_frame, b->clip->pictures[(i + 1) % b->clip->nb_pictures]);
+		view_draw(b->engine, a, s, &rect, b->dst->data, b->dst->linesize, b->width, b->height);
+	}
+}
+
+static void bench_audio_convert(void *arg, int n) {
+
+	BenchArg *b = arg;
+	int i;
+
+	for(i = 0; i < n; i++)
+		decode_frame_from_packet(b->is, *b->clip->samples[i % b->clip->nb_samples]);
+}
+
+static void bench_sync_audio(void *arg, int n) {
+
+	BenchArg *b = arg;
+	int i;
+
+	/* the audio clock 50 ms ahead of the video: samples get added */
+	b->is->video_current_pts = 0;
+	b->is->video_current_pts_time = av_gettime();
+	b->is->audio_clock = 0.05;
+	for(i = 0; i < n; i++)
+		synchronize_audio(b->is, (short *)b->is->audio_buf, b->size, 0);
+}
+
+/* Decode the first BENCH_FRAMES pictures and sound frames of a clip. */
+static int clip_open(BenchClip *clip, const char *filename) {
+
+	AVCodecContext *c[2] = { NULL };
+	AVFrame *frame = NULL;
+	AVPacket pkt;
+	int video = -1, audio = -1, got, i, ret = -1;
+
+	memset(clip, 0, sizeof(*clip));
+	clip->name = filename;
+	if(avformat_open_input(&clip->fmt, filename, NULL, NULL) < 0 || avformat_find_stream_info(clip->fmt, NULL) < 0) {
+		fprintf(stderr, "Could not open %s\n", filename);
+		return -1;
+	}
+	for(i = 0; i < clip->fmt->nb_streams; i++) {
+		if(clip->fmt->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO && video < 0)
+			video = i;
+		else if(clip->fmt->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO && audio < 0)
+			audio = i;
+	}
+	if(video < 0 || audio < 0) {
+		fprintf(stderr, "%s: a video and an audio stream are needed\n", filename);
+		return -1;
+	}
+	c[0] = clip->fmt->streams[video]->codec;
+	c[1] = clip->fmt->streams[audio]->codec;
+	for(i = 0; i < 2; i++) {
+		c[i]->refcounted_frames = 1;
+		if(avcodec_open2(c[i], avcodec_find_decoder(c[i]->codec_id), NULL) < 0) {
+			fprintf(stderr, "%s: could not open the %s decoder\n", filename, avcodec_get_name(c[i]->codec_id));
+			goto end;
+		}
+	}
+	clip->audio_st = clip->fmt->streams[audio];
+
+	frame = av_frame_alloc();
+	while((clip->nb_pictures < BENCH_FRAMES || clip->nb_samples < BENCH_FRAMES) && av_read_frame(clip->fmt, &pkt) >= 0) {
+		got = 0;
+		if(pkt.stream_index == video && clip->nb_pictures < BENCH_FRAMES) {
+			if(avcodec_decode_video2(c[0], frame, &got, &pkt) >= 0 && got)
+				clip->pictures[clip->nb_pictures++] = av_frame_clone(frame);
+		}
+		else if(pkt.stream_index == audio && clip->nb_samples < BENCH_FRAMES) {
+			if(avcodec_decode_audio4(c[1], frame, &got, &pkt) >= 0 && got)
+				clip->samples[clip->nb_samples++] = av_frame_clone(frame);
+		}
+		if(got)
+			av_frame_unref(frame);
+		av_free_packet(&pkt);
+	}
+	if(!clip->nb_pictures || !clip->nb_samples) {
+		fprintf(stderr, "%s: nothing could be decoded\n", filename);
+		goto end;
+	}
+	ret = 0;
+
+end:
+	av_frame_free(&frame);
+	for(i = 0; i < 2; i++) {
+		if(c[i] && c[i]->codec)
+			avcodec_close(c[i]);
+	}
+	return ret;
+}
+
+static void clip_free(BenchClip *clip) {
+
+	int i;
+
+	for(i = 0; i < clip->nb_pictures; i++)
+		av_frame_free(&clip->pictures[i]);
+	for(i = 0; i < clip->nb_samples; i++)
+		av_frame_free(&clip->samples[i]);
+	avformat_close_input(&clip->fmt);
+}
+
+static AVFrame *bench_picture(int format, int width, int height) {
+
+	AVFrame *frame = frame_alloc();
+
+	frame->format = format;
+	frame->width = width;
+	frame->height = height;
+	if(av_frame_get_buffer(frame, FRAME_POOL_ALIGN) < 0) {
+		fprintf(stderr, "Could not allocate a %dx%d picture\n", width, height);
+		exit(1);
+	}
+	return frame;
+}
+
+static void bench_clip(BenchClip *clip) {
+
+	static const char *filters[] = { "none", "bw", "red", "green", "blue" };
+	static const char *view_names[] = { "difference", "wipe", "checkerboard" };
+	const AVFrame *picture = clip->pictures[0];
+	const AVFrame *samples = clip->samples[0];
+	PlayerEngine engine;
+	VideoState is, views[2];
+	struct SwrContext *swr;
+	BenchArg b;
+	char name[256];
+	int flag, i;
+
+	printf("\n%s: %dx%d %s, %d Hz %d channels %s\n", clip->name, picture->width, picture->height,
+			av_get_pix_fmt_name(picture->format), samples->sample_rate, samples->channels,
+			av_get_sample_fmt_name(samples->format));
+
+	memset(&b, 0, sizeof(b));
+	b.clip = clip;
+	b.dst = bench_picture(picture->format, picture->width, picture->height);
+	for(flag = PLAYER_FILTER_BW; flag <= PLAYER_FILTER_BLUE; flag++) {
+		snprintf(name, sizeof(name), "toRGB %s filter", filters[flag]);
+		b.color_flag = flag;
+		bench_run(name, bench_color_filter, &b);
+	}
+	color_filter_uninit(&b.filter);
+	av_frame_free(&b.dst);
+
+	if(picture->format == AV_PIX_FMT_YUV420P) {
+		b.width = picture->width;
+		b.height = picture->height;
+		b.dst = bench_picture(AV_PIX_FMT_YUV420P, b.width, b.height);
+		bench_run("canvas tile_draw plane copy", bench_tile_draw, &b);
+		av_frame_free(&b.dst);
+	}
+	b.width = BENCH_TILE_WIDTH;
+	b.height = BENCH_TILE_HEIGHT;
+	b.dst = bench_picture(AV_PIX_FMT_YUV420P, b.width, b.height);
+	snprintf(name, sizeof(name), "canvas tile_draw sws_scale to %dx%d", b.width, b.height);
+	bench_run(name, bench_tile_draw, &b);
+	av_frame_free(&b.dst);
+	sws_freeContext(b.sws);
+
+	/* the comparison views of two pictures of the clip, on the default window */
+	memset(&engine, 0, sizeof(engine));
+	engine.wipe_pos = 0.5;
+	engine.view_frame = frame_alloc();
+	for(i = 0; i < 2; i++) {
+		memset(&views[i], 0, sizeof(views[i]));
+		views[i].shown_frame = frame_alloc();
+		b.view_channels[i] = &views[i];
+	}
+	b.engine = &engine;
+	b.dst = bench_picture(AV_PIX_FMT_YUV420P, b.width, b.height);
+	for(i = 0; i < FF_ARRAY_ELEMS(view_names); i++) {
+		engine.view = PLAYER_VIEW_DIFF + i;
+		snprintf(name, sizeof(name), "%s view to %dx%d", view_names[i], b.width, b.height);
+		bench_run(name, bench_view, &b);
+	}
+	av_frame_free(&b.dst);
+	for(i = 0; i < 2; i++)
+		av_frame_free(&views[i].shown_frame);
+	av_frame_free(&engine.view_frame);
+	frame_pool_uninit(&engine.view_pool);
+	sws_freeContext(engine.view_sws);
+	sws_freeContext(engine.canvas_sws[0]);
+
+	/* a channel as stream_component_open leaves it, on the video clock */
+	memset(&engine, 0, sizeof(engine));
+	engine.nosync_threshold = AV_NOSYNC_THRESHOLD;
+	memset(&is, 0, sizeof(is));
+	is.engine = &engine;
+	is.av_sync_type = AV_SYNC_VIDEO_MASTER;
+	is.audio_st = clip->audio_st;
+	is.audio_diff_avg_coef = exp(log(0.01 / AUDIO_DIFF_AVG_NB));
+	is.audio_diff_threshold = 2.0 * SDL_AUDIO_BUFFER_SIZE / samples->sample_rate;
+	is.sws_ctx_audio = (void*)swr_alloc();
+	b.is = &is;
+	bench_run("decode_frame_from_packet to S16", bench_audio_convert, &b);
+	b.size = decode_frame_from_packet(&is, *samples);
+	if(b.size > 0)
+		bench_run("synchronize_audio", bench_sync_audio, &b);
+	swr = (void*)is.sws_ctx_audio;
+	swr_free(&swr);
+	av_freep(&is.audio_buf);
+}
+
+int main(int argc, char *argv[]) {
+
+	static const int producers[] = { 1, 2, 4, 8 };
+	BenchClip clip;
+	BenchArg b;
+	char name[256];
+	int i;
+
+	if(argc < 2) {
+		fprintf(stderr, "usage: %s clip...\n", argv[0]);
+		return 1;
+	}
+	if(player_init(-1) < 0)
+		return 1;
+	av_log_set_level(AV_LOG_ERROR);
+	printf("%d cores, %d color filter workers\n", (int)sysconf(_SC_NPROCESSORS_ONLN), worker_pool->nb_threads);
+
+	memset(&b, 0, sizeof(b));
+	for(i = 0; i < FF_ARRAY_ELEMS(producers); i++) {
+		snprintf(name, sizeof(name), "packet_queue_put/get, %d producer%s", producers[i], producers[i] > 1 ? "s" : "");
+		b.producers = producers[i];
+		bench_run(name, bench_queue, &b);
+	}
+
+	for(i = 1; i < argc; i++) {
+		if(clip_open(&clip, argv[i]) >= 0)
+			bench_clip(&clip);
+		clip_free(&clip);
+	}
+	player_uninit();
+	return 0;
+}
@@ -0,0 +1,264 @@
+/***
+ *  Unix Programming - Project 2
+ *
+ *  Special two channel video player based on FFMPEG and SDL
+ *  Made by Yoav Saroya (304835887) & Amit Shmuel (305213621)
+ *
+ *  gen_media: writes the synthetic clips the benchmarks run on. The
+ *  pictures and the sound are computed from the frame number only, so
+ *  every machine gets the same clips without shipping media files.
+ */
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/mathematics.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#define CLIP_FRAME_RATE 25
+#define CLIP_SECONDS 4
+#define CLIP_SAMPLE_RATE 44100
+
+typedef struct ClipSpec {
+	const char      *name;	// file name, the extension picks the container
+	enum AVCodecID  video_codec;
+	enum AVPixelFormat pix_fmt;
+	int             width, height;
+}ClipSpec;
+
+static const ClipSpec clips[] = {
+	{ "mpeg4_320x240.avi",   AV_CODEC_ID_MPEG4,      AV_PIX_FMT_YUV420P,  320,  240 },
+	{ "mpeg2_720x576.ts",    AV_CODEC_ID_MPEG2VIDEO, AV_PIX_FMT_YUV420P,  720,  576 },
+	{ "mpeg4_1280x720.mkv",  AV_CODEC_ID_MPEG4,      AV_PIX_FMT_YUV420P, 1280,  720 },
+	{ "mjpeg_1280x720.avi",  AV_CODEC_ID_MJPEG,      AV_PIX_FMT_YUVJ422P, 1280, 720 },
+	{ "h264_1920x1080.mp4",  AV_CODEC_ID_H264,       AV_PIX_FMT_YUV420P, 1920, 1080 },
+};
+
+/* a gradient that scrolls and a box that moves: every picture differs and
+   compresses like video, not like noise */
+static void fill_picture(AVFrame *frame, int n) {
+
+	int x, y, p, w, h, hshift, vshift;
+
+	avcodec_get_chroma_sub_sample(frame->format, &hshift, &vshift);
+	for(y = 0; y < frame->height; y++) {
+		for(x = 0; x < frame->width; x++)
+			frame->data[0][y * frame->linesize[0] + x] = x + y + 3 * n;
+	}
+	for(y = frame->height / 4 + n % (frame->height / 2); y < frame->height / 4 + n % (frame->height / 2) + frame->height / 8; y++) {
+		for(x = 2 * n % (frame->width / 2); x < 2 * n % (frame->width / 2) + frame->width / 8; x++)
+			frame->data[0][y * frame->linesize[0] + x] = 235;
+	}
+	for(p = 1; p < 3; p++) {
+		w = -((-frame->width) >> hshift);
+		h = -((-frame->height) >> vshift);
+		for(y = 0; y < h; y++) {
+			for(x = 0; x < w; x++)
+				frame->data[p][y * frame->linesize[p] + x] = p == 1 ? 128 + y / 2 + n : 64 + x / 2 + 2 * n;
+		}
+	}
+}
+
+/* a tone sweeping up an octave per second, a fifth higher on the right */
+static void fill_samples(AVFrame *frame, int64_t start) {
+
+	int16_t *s = (int16_t *)frame->data[0];
+	double t;
+	int i, c;
+
+	for(i = 0; i < frame->nb_samples; i++) {
+		t = (double)(start + i) / CLIP_SAMPLE_RATE;
+		for(c = 0; c < frame->channels; c++)
+			*s++ = (int16_t)(8000 * sin(2 * M_PI * 220 * (c ? 1.5 : 1) * (pow(2, t) - 1) / log(2)));
+	}
+}
+
+static int write_packet(AVFormatContext *oc, AVStream *st, AVPacket *pkt) {
+
+	pkt->stream_index = st->index;
+	if(pkt->pts != AV_NOPTS_VALUE)
+		pkt->pts = av_rescale_q(pkt->pts, st->codec->time_base, st->time_base);
+	if(pkt->dts != AV_NOPTS_VALUE)
+		pkt->dts = av_rescale_q(pkt->dts, st->codec->time_base, st->time_base);
+	pkt->duration = av_rescale_q(pkt->duration, st->codec->time_base, st->time_base);
+	return av_interleaved_write_frame(oc, pkt);
+}
+
+/* Encode and write a frame (NULL flushes). Returns 1 while the encoder
+   still gives packets, 0 when it has none, < 0 on error. */
+static int encode(AVFormatContext *oc, AVStream *st, AVFrame *frame) {
+
+	AVPacket pkt;
+	int got_packet = 0, ret;
+
+	av_init_packet(&pkt);
+	pkt.data = NULL;
+	pkt.size = 0;
+	if(st->codec->codec_type == AVMEDIA_TYPE_VIDEO)
+		ret = avcodec_encode_video2(st->codec, &pkt, frame, &got_packet);
+	else
+		ret = avcodec_encode_audio2(st->codec, &pkt, frame, &got_packet);
+	if(ret < 0)
+		return ret;
+	if(!got_packet)
+		return 0;
+	return write_packet(oc, st, &pkt) < 0 ? -1 : 1;
+}
+
+static AVStream *add_stream(AVFormatContext *oc, enum AVCodecID codec_id) {
+
+	AVCodec *codec = avcodec_find_encoder(codec_id);
+	AVStream *st;
+
+	if(!codec)
+		return NULL;
+	st = avformat_new_stream(oc, codec);
+	if(!st)
+		return NULL;
+	if(oc->oformat->flags & AVFMT_GLOBALHEADER)
+		st->codec->flags |= CODEC_FLAG_GLOBAL_HEADER;
+	return st;
+}
+
+static int write_clip(const char *dir, const ClipSpec *spec) {
+
+	AVFormatContext *oc = NULL;
+	AVStream *video_st = NULL, *audio_st = NULL;
+	AVCodecContext *c;
+	AVFrame *picture = NULL, *samples = NULL;
+	char filename[1024], partname[1024];
+	int64_t next_sample = 0;
+	int n, ret = -1;
+
+	/* written under another name and renamed when whole: main keeps the
+	   clips already there, it must never keep a partial one */
+	snprintf(filename, sizeof(filename), "%s/%s", dir, spec->name);
+	snprintf(partname, sizeof(partname), "%s/part-%s", dir, spec->name);
+	avformat_alloc_output_context2(&oc, NULL, NULL, filename);
+	if(!oc) {
+		fprintf(stderr, "%s: no such container\n", filename);
+		return -1;
+	}
+	if(!(video_st = add_stream(oc, spec->video_codec))) {
+		fprintf(stderr, "%s: no %s encoder in this libavcodec, skipped\n", filename, avcodec_get_name(spec->video_codec));
+		avformat_free_context(oc);
+		return 0;
+	}
+	c = video_st->codec;
+	c->pix_fmt = spec->pix_fmt;
+	c->width = spec->width;
+	c->height = spec->height;
+	c->time_base = (AVRational){ 1, CLIP_FRAME_RATE };
+	video_st->time_base = c->time_base;
+	c->gop_size = CLIP_FRAME_RATE;
+	c->max_b_frames = spec->video_codec == AV_CODEC_ID_MJPEG ? 0 : 2;
+	c->bit_rate = (int64_t)spec->width * spec->height * CLIP_FRAME_RATE / 8;
+	c->thread_count = 1;	// the same bitstream on every machine
+	if(avcodec_open2(c, c->codec, NULL) < 0) {
+		fprintf(stderr, "%s: could not open the %s encoder\n", filename, c->codec->name);
+		goto end;
+	}
+
+	if(!(audio_st = add_stream(oc, AV_CODEC_ID_MP2)))
+		goto end;
+	c = audio_st->codec;
+	c->sample_fmt = AV_SAMPLE_FMT_S16;
+	c->sample_rate = CLIP_SAMPLE_RATE;
+	c->channels = 2;
+	c->channel_layout = AV_CH_LAYOUT_STEREO;
+	c->bit_rate = 128000;
+	c->time_base = (AVRational){ 1, CLIP_SAMPLE_RATE };
+	audio_st->time_base = c->time_base;
+	if(avcodec_open2(c, c->codec, NULL) < 0) {
+		fprintf(stderr, "%s: could not open the MP2 encoder\n", filename);
+		goto end;
+	}
+
+	picture = av_frame_alloc();
+	samples = av_frame_alloc();
+	if(!picture || !samples)
+		goto end;
+	picture->format = spec->pix_fmt;
+	picture->width = spec->width;
+	picture->height = spec->height;
+	samples->format = AV_SAMPLE_FMT_S16;
+	samples->channels = 2;
+	samples->channel_layout = AV_CH_LAYOUT_STEREO;
+	samples->sample_rate = CLIP_SAMPLE_RATE;
+	samples->nb_samples = c->frame_size;
+	if(av_frame_get_buffer(picture, 32) < 0 || av_frame_get_buffer(samples, 0) < 0)
+		goto end;
+
+	if(!(oc->oformat->flags & AVFMT_NOFILE) && avio_open(&oc->pb, partname, AVIO_FLAG_WRITE) < 0) {
+		fprintf(stderr, "Could not open %s\n", partname);
+		goto end;
+	}
+	if(avformat_write_header(oc, NULL) < 0)
+		goto end;
+	for(n = 0; n < CLIP_FRAME_RATE * CLIP_SECONDS; n++) {
+		fill_picture(picture, n);
+		picture->pts = n;
+		if(encode(oc, video_st, picture) < 0)
+			goto end;
+		/* the sound that goes with the picture */
+		while(next_sample < (int64_t)(n + 1) * CLIP_SAMPLE_RATE / CLIP_FRAME_RATE) {
+			fill_samples(samples, next_sample);
+			samples->pts = next_sample;
+			next_sample += samples->nb_samples;
+			if(encode(oc, audio_st, samples) < 0)
+				goto end;
+		}
+	}
+	while((ret = encode(oc, video_st, NULL)) > 0);
+	while(ret >= 0 && (ret = encode(oc, audio_st, NULL)) > 0);
+	if(ret < 0 || av_write_trailer(oc) < 0) {
+		ret = -1;
+		goto end;
+	}
+	ret = 0;
+
+end:
+	av_frame_free(&picture);
+	av_frame_free(&samples);
+	if(video_st && video_st->codec->codec)
+		avcodec_close(video_st->codec);
+	if(audio_st && audio_st->codec->codec)
+		avcodec_close(audio_st->codec);
+	if(oc->pb && !(oc->oformat->flags & AVFMT_NOFILE))
+		avio_close(oc->pb);
+	if(!ret && rename(partname, filename) < 0)
+		ret = -1;
+	if(ret < 0) {
+		fprintf(stderr, "%s: could not be written\n", filename);
+		remove(partname);
+	}
+	else
+		printf("%s: %dx%d %s, %d s\n", filename, spec->width, spec->height, avcodec_get_name(spec->video_codec), CLIP_SECONDS);
+	avformat_free_context(oc);
+	return ret;
+}
+
+int main(int argc, char *argv[]) {
+
+	const char *dir = argc > 1 ? argv[1] : "media";
+	char filename[1024];
+	struct stat st;
+	int i, failed = 0;
+
+	av_register_all();
+	av_log_set_level(AV_LOG_ERROR);
+	mkdir(dir, 0755);
+	for(i = 0; i < FF_ARRAY_ELEMS(clips); i++) {
+		/* the clips only depend on this program: keep the ones already there */
+		snprintf(filename, sizeof(filename), "%s/%s", dir, clips[i].name);
+		if(!stat(filename, &st) && st.st_size > 0)
+			continue;
+		if(write_clip(dir, &clips[i]) < 0)
+			failed = 1;
+	}
+	return failed;
+}
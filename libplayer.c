@@ -0,0 +1,7039 @@
+/***  
+ *  Unix Programming - Project 2 
+
+ *
+ *  Special two channel video player based on FFMPEG and SDL
+ *  Made by Yoav Saroya (304835887) & Amit Shmuel (305213621)
+ *
+ *  libplayer: the playback engine (see player.h)
+ */
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavformat/avio.h>
+#include <libswresample/swresample.h>
+#include <libswscale/swscale.h>
+#include <libavutil/avstring.h>
+#include <libavutil/opt.h>
+#include <libavutil/time.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/audio_fifo.h>
+#include <libavutil/crc.h>
+
+#include <SDL.h>
+#include <SDL_thread.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "player.h"
+#include "playerstat.h"
+
+#define SDL_AUDIO_BUFFER_SIZE 1024
+#define MAX_QUEUE_DURATION 2.0	/* seconds buffered per queue before the demuxer blocks */
+#define MIN_QUEUE_DURATION 1.0	/* low-water mark the demuxer waits for before reading again */
+#define MAX_QUEUE_SIZE (15 * 1024 * 1024)	/* bytes of packets a channel queues, whatever their duration (no -membudget) */
+#define MIN_QUEUE_BUDGET (1024 * 1024)	/* packet bytes a channel keeps under any memory budget */
+#define EST_BITS_PER_PIXEL 3	/* bitrate guess per pixel and second when the container has none */
+#define AV_SYNC_THRESHOLD 0.01
+#define AV_NOSYNC_THRESHOLD 10.0
+#define SAMPLE_CORRECTION_PERCENT_MAX 10
+#define AUDIO_DIFF_AVG_NB 20
+#define FRAME_POOL_ALIGN 32
+#define MAX_SLICES 64	/* horizontal slices a color filter pass is split into */
+#define MIN_SLICE_HEIGHT 16
+#define MAX_LUT_SIZE 128
+#define EXPORT_QUEUE_SIZE 8	/* frames waiting for the encoder thread */
+#define RECORD_QUEUE_SIZE 8	/* captured screens waiting for the recorder thread */
+#define RECORD_FRAME_RATE 30
+#define RECORD_AUDIO_SECONDS 2	/* played audio buffered for the recorder */
+#define FF_ALLOC_EVENT   (SDL_USEREVENT)
+#define FF_REFRESH_EVENT (SDL_USEREVENT + 1)
+#define FF_QUIT_EVENT (SDL_USEREVENT + 2)
+#define FF_PRESENT_EVENT (SDL_USEREVENT + 3)
+#define FF_STATS_EVENT (SDL_USEREVENT + 4)
+#define VIDEO_PICTURE_QUEUE_SIZE 1
+#define MAX_PLAYLIST_SIZE 4096
+#define PROBE_CACHE_SIZE 64
+#define FAST_PROBE_SIZE 32768	/* bytes probed in fast start mode */
+#define FAST_ANALYZE_DURATION 100000	/* microseconds analyzed in fast start mode */
+#define DEFAULT_AV_SYNC_TYPE AV_SYNC_VIDEO_MASTER
+#define LIVE_NOSYNC_THRESHOLD 1.0	/* live mode: timestamp jumps beyond this resync at once */
+#define LIVE_DROP_THRESHOLD 0.02	/* live mode: seconds past its slot before a picture is dropped */
+#define LIVE_MAX_DROPS 4	/* consecutive late pictures dropped before one is shown anyway */
+#define LIVE_CATCHUP_STEP 0.005	/* schedule advance per picture while we are behind */
+#define LIVE_REPORT_INTERVAL 5	/* seconds between latency reports */
+#define COMPARE_PTS_TOLERANCE 0.5	/* of a frame duration: pictures further apart are not a pair */
+#define COMPARE_CAPTION_INTERVAL 500000	/* microseconds between updates of the metrics caption */
+#define VIEW_CHECKER_SIZE 64	/* checkerboard view: pixels per cell */
+#define VIEW_STALE 500000	/* microseconds a view waits for pictures of the same pts */
+#define SYNC_BARRIER_TIMEOUT 2000000	/* microseconds a seek waits for the other channel at most */
+#define MAX_DECODERS 16	/* decoders of an intra-only decode pool */
+#define INTRA_PROBE_PACKETS 32	/* H.264 keyframes in a row before we take it for all-intra */
+#define LOOP_MAX_SIZE (256 * 1024 * 1024)	/* bytes of packets and pictures an A-B loop keeps without -membudget */
+#define LOOP_MIN_LENGTH 0.1	/* seconds between A and B at least */
+#define LOOP_NOSYNC_THRESHOLD 0.5	/* A-B loop: audio and video further apart are at the seam */
+#define STAT_INTERVAL 100000	/* microseconds between updates of the shared statistics */
+#define SPEED_MIN 0.5	/* slowest and fastest playback, times the media rate */
+#define SPEED_MAX 4.0
+#define STRETCH_SEQUENCE_MS 40	/* the time-stretch copies the sound in pieces this long, ... */
+#define STRETCH_OVERLAP_MS 8	/* ... crossfades them over this ... */
+#define STRETCH_SEEK_MS 15	/* ... and looks this far for where each fits the previous best */
+#define VERIFY_QUEUE_SIZE 16	/* pictures of a channel waiting to be hashed */
+#define VERIFY_BLOCK_SIZE 4096	/* hashes per allocation */
+
+/* Allocations done by the video pipeline. Once playback has started and
+   the pools are warm, the first three should not move; the AVBufferRef
+   wrappers are small but come with every picture. */
+typedef struct AllocStats {
+	int             frames;	// AVFrame structures
+	int             buffers;	// picture buffers added to a FramePool
+	int             default_buffers;	// pictures from avcodec_default_get_buffer2 (codecs without DR1)
+	int             refs;	// AVBufferRef wrappers, one per plane of a pool get or a frame reference
+}AllocStats;
+
+static AllocStats alloc_stats;	/* process-wide, all engines */
+
+/* -membudget, one for every engine of the process. Each channel charges
+   what it holds besides its packet queues to 'fixed': picture pools,
+   overlays, audio buffers, the preloaded item and the loop caches. What
+   is left goes to the packet queues of all channels, in proportion to
+   their input rate. */
+typedef struct MemBudget {
+	int64_t         budget;	// bytes, 0 keeps the fixed queue caps
+	int64_t         fixed;	// charged by all channels (atomic)
+	int64_t         rate;	// input rates of all channels, bytes per second (atomic)
+	int             warned;	// budget too small, said once
+}MemBudget;
+
+static MemBudget mem_budget;
+
+/* a channel counter and the process total move together */
+static void mem_charge(int64_t *usage, int64_t delta) {
+
+	__sync_fetch_and_add(usage, delta);
+	__sync_fetch_and_add(&mem_budget.fixed, delta);
+}
+
+/* Process-wide pool of worker threads that run the slices of a job. Several
+   threads may submit work at once (one toRGB per channel); each submitter
+   runs slices of its own job too while it waits for the workers. */
+typedef void (*slice_func)(void *arg, int slice, int nb_slices);
+
+typedef struct SliceJob {
+	slice_func      fn;
+	void            *arg;
+	int             nb_slices, next_slice, done_slices;
+	struct SliceJob *next;
+}SliceJob;
+
+typedef struct WorkerPool {
+	pthread_t       *threads;
+	int             nb_threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t  work_cond;	// workers wait for jobs
+	pthread_cond_t  done_cond;	// submitters wait for their job to finish
+	SliceJob        *jobs;	// jobs with slices left to hand out
+	int             quit;
+}WorkerPool;
+
+static WorkerPool *worker_pool;	/* shared by the engines, player_init starts it */
+
+/* RGB color filter split in horizontal slices. Every slice converts its
+   rows to RGB, filters them and converts them back with its own scaler
+   contexts, so slices run in parallel without sharing state. */
+typedef struct ColorFilter {
+	int             width, height, format;
+	int             nb_slices;
+	int             slice_y[MAX_SLICES + 1];
+	struct SwsContext *to_rgb[MAX_SLICES], *from_rgb[MAX_SLICES];
+	AVFrame         *rgb;	// the whole picture in RGB24
+	uint8_t         *rgb_buffer;
+
+	const AVFrame   *src;	// arguments of the pass being run
+	AVFrame         *dst;
+	int             color_flag;
+	const struct Lut3D *lut;	// for color_flag 6
+	int             keep_rgb;	// cf->rgb must hold the filtered picture (screenshots)
+}ColorFilter;
+
+/* 3D color LUT loaded from a .cube file. The grid is kept as four-float
+   vectors (r, g, b, unused) pre-scaled to 0..255, and the position of every
+   8-bit input value in the grid (cell and fraction along each axis) is
+   precomputed, so a lookup is a few loads and vector multiply-adds. */
+typedef float v4f __attribute__((vector_size(16)));
+
+typedef struct Lut3D {
+	int             size;	// grid points per axis
+	v4f             *table;	// size^3 entries, red varies fastest
+	v4f             *table_yuv;	// the same grid converted to BT.601 Y, U, V (+0.5 for rounding)
+	int             index[3][256];	// offset of the cell in the table, per axis
+	float           frac[3][256];	// position inside the cell, per axis
+}Lut3D;
+
+/* Stream parameters found by avformat_find_stream_info, kept per file so
+   opening the same file again (playlist loops, both channels on one file)
+   can skip probing. Files are identified by device, inode, size and mtime. */
+typedef struct ProbeCacheEntry {
+	dev_t           dev;
+	ino_t           ino;
+	off_t           size;
+	time_t          mtime;
+	int             nb_streams;
+	AVCodecContext  **codec;
+	AVRational      *r_frame_rate, *avg_frame_rate;
+	int64_t         start_time, duration;
+}ProbeCacheEntry;
+
+/* shared by the engines: a file probed by one is known to all */
+static ProbeCacheEntry probe_cache[PROBE_CACHE_SIZE];
+static int probe_cache_next;
+static pthread_mutex_t probe_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct PacketList {
+	AVPacket pkt;
+	int64_t arrival;	/* av_gettime() when the packet was queued */
+	struct PacketList *next;
+}PacketList;
+
+typedef struct PacketQueue {
+	PacketList *first_pkt, *last_pkt;
+	int64_t last_arrival;	/* arrival time of the packet last taken out */
+	int abort_request;	/* set when the engine stops: nothing waits on the queue any more */
+	int nb_packets;
+	int size;
+	int64_t duration;	/* sum of packet durations, in time_base units */
+	AVRational time_base;
+	SDL_mutex *mutex;
+	SDL_cond *cond;
+}PacketQueue;
+
+typedef struct VideoPicture {
+	SDL_Overlay *bmp;
+	int width, height; /* source height & width */
+	int allocated;
+	double pts;
+	int item_start;	/* first picture of a new playlist item */
+	int serial;	/* seek_serial of the decoder flush before it */
+	int64_t arrival;	/* arrival time of the packet the picture was decoded from */
+	AVFrame *frame;	/* export mode and canvas renderer: the picture itself instead of an overlay */
+}VideoPicture;
+
+/* Picture buffers of one format and size, drawn from an AVBufferPool per
+   plane. A buffer goes back to its pool when the last frame referencing
+   it is unreffed, so steady-state playback allocates nothing. */
+typedef struct FramePool {
+	AVBufferPool    *pools[4];
+	int             nb_planes;
+	int             format, width, height;
+	int             linesize[4];
+	int64_t         bytes;	// allocated by the pools so far
+	int64_t         *usage;	// counter of the channel the buffers are charged to
+}FramePool;
+
+static __thread FramePool *frame_pool_filling;	/* pool whose buffer is being allocated */
+
+/* Output file of the export mode: the composited picture and the audio of
+   one channel. Encoding and muxing run on a thread of their own; the
+   producers hand it frames through a small queue and go on decoding. */
+typedef struct Exporter {
+	AVFormatContext *oc;
+	AVStream        *video_st, *audio_st;	// st->codec are the encoders
+	int             width, height;
+	AVRational      frame_rate;
+
+	FramePool       canvas_pool;	// composited pictures
+	struct SwsContext *tile_sws[2];	// scalers of the two channels onto the canvas
+
+	struct SwrContext *swr;	// decoded S16 audio to the encoder's format
+	int             swr_rate, swr_channels;
+	uint8_t         **conv;	// converted samples on their way to the fifo
+	int             conv_samples;
+	AVAudioFifo     *fifo;	// cuts the audio in frames of the encoder's size
+	int             audio_frame_size, variable_frame_size;
+	int64_t         audio_next_pts;	// in samples
+	AVFrame         *audio_frame;
+
+	AVFrame         *queue[EXPORT_QUEUE_SIZE];	// slots frames are moved in and out of
+	int             queue_size, rindex, windex, eof;
+	pthread_mutex_t mutex;
+	pthread_cond_t  cond;
+	pthread_t       thread;
+}Exporter;
+
+/* What the screen shows at one moment: the picture of each channel, where
+   it goes and the filter the output applies to it. */
+typedef struct Composition {
+	AVFrame         *pictures[2];
+	SDL_Rect        rects[2];	// empty when the channel is not shown
+	int             color_flags[2];
+	int64_t         time;	// av_gettime() of the capture (recording)
+}Composition;
+
+/* Live recording of the screen. The display takes references to what it
+   shows and the audio callback copies what it plays; neither ever waits
+   for the recorder, whose thread composites and feeds an Exporter. */
+typedef struct Recorder {
+	struct VideoState *channels[2];
+	PlayerConfig    cfg;	// encoder settings; the thread may outlive the engine
+	char            filename[64];
+	int             width, height;
+	Exporter        *ex;
+	int64_t         start;	// av_gettime() when recording started
+
+	Composition     queue[RECORD_QUEUE_SIZE];
+	int             queue_size, rindex, windex, stop;
+	pthread_mutex_t mutex;
+	pthread_cond_t  cond;
+	pthread_t       thread;
+
+	uint8_t         *audio_ring;	// interleaved S16 as played, audio_fill bytes from audio_rindex
+	int             audio_ring_size, audio_rindex, audio_fill;
+	int             audio_rate, audio_channels;
+	int64_t         audio_start;	// av_gettime() of the first sample, 0 before
+	pthread_mutex_t audio_mutex;
+
+	int64_t         last_pts;
+	int             captured, dropped;	// screens queued, screens dropped because the recorder was behind
+	int64_t         audio_dropped;	// bytes of audio dropped
+}Recorder;
+
+/* Comparison of the two channels ('a'): a picture of the primary and the
+   picture of the second channel with the same pts are measured (PSNR and
+   SSIM of each plane) on a thread of their own. The display thread never
+   waits for it; a pair that comes while the last one is still being
+   measured is skipped. */
+typedef struct Comparator {
+	AVFrame         *pictures[2];	// the pair being measured
+	double          pts;
+	int             busy, quit;	// busy: the thread has a pair (mutex)
+	int             serials[2];	// shown_serial of the last pair offered
+	pthread_mutex_t mutex;
+	pthread_cond_t  cond;
+	pthread_t       thread;
+
+	struct SwsContext *sws[2];	// pictures to YUV420P of the primary's size
+	FramePool       pool;
+	AVFrame         *converted[2];
+	int             (*ssim_sums)[4];	// two rows of 4x4 block sums
+	unsigned int    ssim_sums_size;
+
+	char            filename[64];	// CSV log
+	FILE            *log;
+	double          psnr[3], ssim[3];	// last pair, Y U V (mutex)
+	double          psnr_sum, ssim_sum;	// luma, over the pairs measured (PSNR: the finite ones)
+	int             compared, psnr_count, skipped;
+	int64_t         caption_time;
+}Comparator;
+
+/* CRC32 of each plane of a decoded picture, as written to the verify file */
+typedef struct VerifyHash {
+	double          pts;
+	uint32_t        crc[4];
+	int             nb_planes;
+}VerifyHash;
+
+typedef struct VerifyChannel {
+	VerifyHash      **blocks;	// hash 'n' is blocks[n / VERIFY_BLOCK_SIZE][n % VERIFY_BLOCK_SIZE]
+	int             nb_blocks;
+	int             count;	// pictures handed in
+	int             in_flight;	// of those, not hashed yet
+	int             ended;
+}VerifyChannel;
+
+/* Verify mode: the video threads hand every decoded picture over as it
+   is and go on decoding; a pool of threads hashes them. Each hash lands in
+   the slot of its picture's number, so the results come out in decoding
+   order whatever order the threads finish in. */
+typedef struct Verifier {
+	VerifyChannel   channels[2];
+	struct {
+		AVFrame     *frame;
+		int         channel, n;
+	}queue[2 * VERIFY_QUEUE_SIZE];	// pictures waiting for a thread
+	int             queue_size, rindex, windex, quit;
+	pthread_mutex_t mutex;
+	pthread_cond_t  cond;	// the threads wait for pictures, the video threads for room
+	pthread_t       *threads;
+	int             nb_threads;
+	const AVCRC     *crc_table;
+}Verifier;
+
+/* Intra-only video (MJPEG, ProRes, DNxHD, all-intra H.264): every picture
+   decodes on its own, so the video thread hands the packets to a pool of
+   decoders, one per thread, and takes the pictures back in packet order,
+   which is their pts order, whatever order the decoders finish in. */
+typedef struct DecodeJob {
+	AVPacket        pkt;
+	AVFrame         *frame;
+	int64_t         arrival;	// of the packet, for live mode
+	int             done;
+}DecodeJob;
+
+typedef struct DecodeWorker {
+	struct DecodePool *dp;
+	AVCodecContext  *ctx;
+	FramePool       pool;	// the buffers this decoder decodes into
+	pthread_t       thread;
+}DecodeWorker;
+
+typedef struct DecodePool {
+	DecodeWorker    workers[MAX_DECODERS];
+	int             nb_workers;
+	DecodeJob       jobs[2 * MAX_DECODERS];	// ring of the packets in flight, job n in jobs[n % nb_jobs]
+	int             nb_jobs;
+	int64_t         submitted, taken, output;	// jobs sent, picked up by a decoder, passed on
+	int             quit;
+	pthread_mutex_t mutex;
+	pthread_cond_t  cond;	// decoders wait for packets, the video thread for pictures
+}DecodePool;
+
+/* A-B loop: after a seek to A the segment is read once, from the keyframe
+   before A up to B, and its packets are kept so that every repeat is
+   queued again from memory, with no seek and no demuxing. The video thread
+   also keeps the pictures between A and B when they fit in the budget and
+   shows them again instead of decoding. */
+enum {
+	LOOP_OFF,
+	LOOP_SEEKING,	// going back to A
+	LOOP_RECORDING,	// first pass, the packets are kept
+	LOOP_REPLAY,	// the repeats, from the kept packets
+};
+
+typedef struct LoopCache {
+	int             state;	// LOOP_*
+	AVPacket        *pkts;	// in the order they were read
+	int             nb_pkts, alloc;
+	int             pos;	// replay: next packet to queue
+	int64_t         bytes;
+	int             nocache;	// beyond the budget: every repeat is a seek
+	int             past_b[2];	// audio, video: read up to B
+}LoopCache;
+
+enum {
+	LOOP_FRAMES_NONE,
+	LOOP_FRAMES_RECORDING,	// first pass, the pictures are kept
+	LOOP_FRAMES_COMPLETE,	// repeats are not decoded, the kept pictures are shown
+	LOOP_FRAMES_OVER,	// beyond the budget: every repeat is decoded
+};
+
+typedef struct LoopFrame {
+	AVFrame         *frame;
+	double          pts;
+}LoopFrame;
+
+/* WSOLA time-stretch of the sound heard, so that it plays faster or
+   slower at the same pitch. Only the audio callback touches it. */
+typedef struct TimeStretch {
+	double          speed;	// of the output so far, 1 when not stretching
+	int             channels, rate;	// of the input, the lengths below are for them
+	int             sequence, overlap, seek;	// sample frames
+	int             corr_shift;	// keeps the SSE2 correlation sums in 32 bits
+	int16_t         *in;	// input not used up yet, interleaved S16
+	unsigned int    in_alloc;
+	int             in_frames;
+	double          skip_frac;	// fraction of a frame the next skip carries
+	int16_t         *mid;	// end of the previous piece, crossfaded into the next
+	int             have_mid;
+	int16_t         *window;	// crossfade weights of mid and the input per sample, Q14 pairs
+	uint8_t         *out;
+	unsigned int    out_alloc;
+}TimeStretch;
+
+/* One opened playlist item. The demuxer, the audio decoder and the video
+   decoder each hold a reference; the item that plays next is linked
+   through 'next' so the decoders can follow the demuxer across items. */
+typedef struct MediaSource {
+	AVFormatContext *pFormatCtx;
+	int             videoStream, audioStream;
+	char            filename[1024];
+
+	double          pts_offset;	// added to this item's timestamps to keep the timeline continuous
+	double          end_pts;	// end of the last packet read, in this item's own timeline
+	int             serial;	// seek_serial at the time the demuxer switched to this item
+
+	FramePool       video_pool;	// buffers the video decoder decodes into
+	AVFrame         *primed_frame;	// first video frame, decoded ahead on the playlist thread
+	double          primed_pts;
+	int             video_done;	// the video decoder moved on to the next item
+	PacketQueue     audioq, videoq;	// packets read while priming
+	int64_t         ready_time;	// av_gettime() when priming finished
+
+	int             refcount;
+	struct MediaSource *next;	// the item that plays after this one
+	struct MediaSource *retired_next;	// list of items waiting to be closed
+}MediaSource;
+
+typedef struct Playlist {
+	char            **items;
+	int             nb_items;
+	int             next;	// index of the item the playlist thread opens next
+}Playlist;
+
+typedef struct VideoState {
+	AVFormatContext *pFormatCtx;
+	int             videoStream, audioStream;
+
+	int             av_sync_type;
+	int64_t         external_clock_time;
+	int             seek_req;
+	int             seek_flags;
+	int64_t         seek_pos;
+
+	double          audio_clock;
+	AVStream        *audio_st;
+	PacketQueue     audioq;
+	AVFrame         audio_frame;
+	uint8_t         *audio_buf;	// decoded samples, grown to the largest frame seen
+	unsigned int    audio_buf_alloc;
+	unsigned int    audio_buf_size;
+	unsigned int    audio_buf_index;
+	AVPacket        audio_pkt;
+	uint8_t         *audio_pkt_data;
+	int             audio_pkt_size;
+	int             audio_hw_buf_size;
+	double          audio_diff_cum; /* used for AV difference average computation */
+	double          audio_diff_avg_coef;
+	double          audio_diff_threshold;
+	int             audio_diff_avg_count;
+	TimeStretch     stretch;	// speeds other than 1
+	double          frame_timer;
+	double          frame_last_pts;
+	double          frame_last_delay;
+	double          video_clock; ///<pts of last decoded frame / predicted pts of next decoded frame
+	double          video_current_pts; ///<current displayed pts (different from video_clock if frame fifos are used)
+	int64_t         video_current_pts_time;  ///<time (av_gettime) at which we updated video_current_pts - used to have 		running video pts
+	AVStream        *video_st;
+	PacketQueue     videoq;
+	VideoPicture    pictq[VIDEO_PICTURE_QUEUE_SIZE];
+	int             pictq_size, pictq_rindex, pictq_windex;
+
+	AVFrame		*colorq[VIDEO_PICTURE_QUEUE_SIZE];
+	int             colorq_size, colorq_rindex, colorq_windex;
+
+	SDL_mutex       *pictq_mutex;
+	SDL_cond        *pictq_cond;
+
+	SDL_mutex		 *colorq_mutex;
+	SDL_cond		 *colorq_cond;
+
+	SDL_mutex		 *read_mutex;	// demuxer backpressure: decode_thread sleeps on read_cond
+	SDL_cond		 *read_cond;	// until the queues drain, a seek is requested or we quit
+	int				read_waiting;
+
+	Playlist		playlist;
+	MediaSource		*src;	// item the demuxer reads from
+	MediaSource		*audio_src, *video_src;	// items the decoders are on
+	MediaSource		*preloaded, *retired;	// handoff with the playlist thread (read_mutex)
+	int				preload_req, preload_done;
+	SDL_cond		 *preload_cond;
+	SDL_Thread		*playlist_tid;
+	int				seek_serial;
+	int				curr_item_start;
+	int				video_serial, curr_serial;	// seek_serial of the last flush, at the video and the color thread
+	int				sync_serial;	// lock mode: pictures of older serials are from before the seek
+	int				sync_seek;	// lock mode: the demuxer sets sync_serial at its next seek
+	int				sync_held;	// lock mode: a picture from after the seek waits for the other channel
+	DecodePool		*decode_pool;	// intra-only stream: decoded in parallel (video thread)
+	int				intra_run;	// H.264: keyframes in a row so far, -1 once a packet was not one
+	int				intra_decoders;	// decoders of the pool, for the statistics
+	double			drift, drift_sum, drift_max;	// lock mode: seconds ahead of the master clock
+	int				drift_count;
+	int64_t			last_display_time;
+
+	int				fast_path_frames;	// pictures plane-copied to the screen
+	int				scaled_frames;	// pictures converted with sws_scale
+	int				late_frames;	// pictures shown after their time
+	int				audio_underruns;	// audio device fed silence, nothing decoded in time
+	int				video_underruns;	// a picture was due and none was ready
+	int64_t			video_pictures;	// put out by the video thread: decoded, or kept by an A-B loop
+	int64_t			open_time;	// startup, av_gettime(): the item opened, probed and its codecs open ...
+	int64_t			first_picture_time;	// ... the first picture decoded ...
+	int64_t			first_shown_time;	// ... and on the screen (exported, for engines without display)
+
+	FramePool		filter_pool;	// output pictures of the color filters
+	int64_t			mem_frames;	// bytes of the channel's picture pools (atomic)
+	int64_t			mem_overlays;	// bytes of its overlays (atomic)
+	int64_t			mem_audio;	// bytes of audio_buf and the time-stretch buffers (atomic)
+	int64_t			mem_cache;	// bytes of the preloaded item's packets and the loop caches (atomic)
+	int64_t			preload_bytes;	// what the preloaded item charged to mem_cache (read_mutex)
+	int64_t			byte_rate;	// estimated input rate of the current item, charged to mem_budget.rate
+
+	AVFrame			*shown_frame;	// reference to the picture on screen (canvas, recording)
+	int				shown_serial;	// bumped when shown_frame changes
+	int				opened;	// 1 once decode_thread has the codecs open, -1 if it failed (read_mutex)
+	int				export_audio;	// export mode: this channel's audio goes to the file
+	double			export_base;	// export mode: pts of the first picture, time 0 of the file
+
+	double			live_offset;	// live mode: a picture is due at pts + live_offset
+	int				live_started;	// live_offset is set, the jitter buffer has filled
+	int				live_drop_run;	// late pictures dropped in a row
+	int				live_dropped, live_rebuffers;
+	double			live_latency_sum, live_latency_max;	// since the last report
+	int				live_latency_count;
+	int64_t			live_report_time;
+
+	SDL_Thread      *parse_tid;
+	SDL_Thread      *video_tid;
+	pthread_t       color_tid;	// toRGB
+	int             color_started;
+	SDL_TimerID     refresh_timer;
+	int             refresh_waiting;	// no picture to show: queue_picture restarts the refresh (pictq_mutex)
+	int             refresh_stopped;	// paused: no refresh pending, resuming or stepping restarts it
+	int             step;	// paused: show one more picture
+	int             keepup;	// video thread: nobody sees us, only keyframes are decoded
+	int             keepup_resync;	// the picture after keep-up mode restarts frame_timer
+	int             audio_skipping;	// nobody hears us, audio packets are dropped undecoded
+	int             audio_eof;	// the audio decoder got eof_pkt
+	int64_t         refresh_due;	// virtual clock: engine_time() of the next refresh, -1 while waiting for a picture
+	int             video_ended;	// virtual clock: the last picture was shown
+	double          av_sum, av_max;	// virtual clock: audio clock minus pts of the pictures shown
+	int             av_count;
+	double          loop_a, loop_b;	// A-B loop on the playlist timeline, loop_b 0 when there is none
+	int             loop_req;	// loop_a and loop_b changed, for the demuxer (read_mutex)
+	LoopCache       loop;	// demuxer: the packets of the loop
+	LoopFrame       *loop_frames;	// video thread: the pictures of the loop
+	int             nb_loop_frames, loop_frames_alloc;
+	int             loop_frame_next;	// next picture of the repeat
+	int             loop_frames_state;	// LOOP_FRAMES_*
+	int64_t         loop_frame_bytes;
+
+	char            filename[1024];
+	int             quit;
+
+	struct SwsContext *sws_ctx;
+
+	struct SwsContext *sws_ctx_audio;
+
+	int			  color_flag, save_picture_flag, flag_sound;
+	double			curr_pts;
+
+	struct VideoState	*is2;	// another VideoState representing the small video
+	int				is_small; // small video flag	
+
+	struct PlayerEngine *engine;
+}VideoState;
+
+/* How pictures get on the screen. 'upload' runs on the video thread and
+   fills a queued picture, 'present' shows it on the event thread; 'open'
+   and 'close' (optional) set up what the engine's screen needs. upload
+   returns < 0 to stop, 1 when the picture cannot be shown. */
+typedef struct Renderer {
+	const char      *name;
+	int             (*open)(struct PlayerEngine *e);
+	void            (*close)(struct PlayerEngine *e);
+	int             (*upload)(VideoState *is, VideoPicture *vp, AVFrame *frame);
+	void            (*present)(VideoState *is, VideoPicture *vp);
+}Renderer;
+
+/* Everything one player owns: both channels and what they share (the
+   screen, the audio device, the recorder or the exporter). */
+struct PlayerEngine {
+	PlayerConfig    cfg;
+	VideoState      *channels[2];	// primary and second channel
+	VideoState      *audio_channel;	// the channel being heard, seeks go to it
+	SDL_Surface     *screen;	// NULL without display
+	const Renderer  *renderer;
+	SDL_Overlay     *canvas;	// canvas renderer: the whole screen
+	SDL_Rect        canvas_rects[2];	// where the tiles on the canvas are
+	int             canvas_serials[2];	// shown_serial of the pictures drawn there
+	struct SwsContext *canvas_sws[2];
+	int             view;	// PLAYER_VIEW_*, drawn on the canvas
+	double          wipe_pos;	// wipe view: divider position, 0 to 1 of the width
+	int             view_dirty;	// view or divider changed, compose again
+	int             present_pending;	// canvas: an FF_PRESENT_EVENT is queued
+	int64_t         view_time;	// av_gettime() the view was last composed
+	FramePool       view_pool;
+	AVFrame         *view_frame;	// the second picture, scaled like the primary
+	struct SwsContext *view_sws;
+	SDL_AudioSpec   wanted_spec, spec;
+	int             audio_open;	// we hold the SDL audio device
+	int             multi_videos;	// both channels on screen
+	int             mute;
+	double          speed;	// times the media rate both channels play at
+	int             paused;	// both channels, the clocks stand still
+	int64_t         pause_time;	// av_gettime() when paused
+	int             sync_lock;	// one clock for both channels, seeks go to both
+	double          clock_pts;	// lock mode: the master clock was at clock_pts ...
+	int64_t         clock_time;	// ... at this av_gettime(), 0 until the first picture
+	int             sync_barrier;	// lock mode: a seek is waiting for both channels
+	int64_t         sync_barrier_time;
+	double          loop_a;	// A mark of the next loop, -1 when there is none
+	VideoState      *loop_channel;	// the channel looping, NULL when none is
+	double          nosync_threshold;	// clock differences beyond this are not corrected
+	Lut3D           *lut;
+	Exporter        *exporter;
+	Recorder        *recorder;
+	pthread_t       recorder_thread;	// a stopped recording still finishing its file, 0 when none
+	Comparator      *comparator;
+	Verifier        *verifier;
+	int             headless;	// export, verify or virtual clock: no display, no audio device, playlists play once
+	int             virtual_clock;	// time comes from the pictures and samples played, not the wall clock
+	int64_t         virtual_time;	// virtual clock: microseconds the scheduler has reached (virtual_mutex)
+	SDL_mutex       *virtual_mutex;
+	SDL_cond        *virtual_cond;	// the scheduler waits for a picture it needs
+	FILE            *virtual_log;	// virtual clock: the sync decisions, one line each
+	int64_t         launch_time;	// av_gettime() when the engine was opened
+	AllocStats      alloc_stats_last;	// alloc_stats at the previous report
+	PlayerStatBlock *stat_block;	// shared statistics, written by the event thread
+	char            stat_name[64];
+	SDL_TimerID     stat_timer;	// an FF_STATS_EVENT every STAT_INTERVAL, stopped while paused
+	int64_t         stat_time;	// av_gettime() of the last update
+	int64_t         stat_pictures[2];	// pictures of each channel then
+	struct PlayerEngine *next;	// list of open engines
+};
+
+enum {AV_SYNC_AUDIO_MASTER,AV_SYNC_VIDEO_MASTER,AV_SYNC_EXTERNAL_MASTER};
+
+/* Engines that are open. SDL events of an engine may still be queued
+   after it is closed; they are only handled while it is on this list. */
+static PlayerEngine *engines;
+static pthread_mutex_t engines_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Queue markers, the same for every engine; only their data pointer is
+   compared. */
+static AVPacket flush_pkt;
+static AVPacket switch_pkt;	/* marks the boundary between two playlist items in a queue */
+static AVPacket eof_pkt;	/* export mode: the channel has nothing more to read */
+static AVPacket loop_pkt;	/* A-B loop: the packets after it are a repeat */
+
+static AVFrame *frame_alloc(void) {
+
+	__sync_fetch_and_add(&alloc_stats.frames, 1);
+	return av_frame_alloc();
+}
+
+/* av_frame_ref, counting the wrappers it allocates */
+static int frame_ref(AVFrame *dst, AVFrame *src) {
+
+	int i;
+
+	for(i = 0; i < AV_NUM_DATA_POINTERS && src->buf[i]; i++);
+	__sync_fetch_and_add(&alloc_stats.refs, i);
+	return av_frame_ref(dst, src);
+}
+
+static AVBufferRef *frame_pool_buffer_alloc(int size) {
+
+	FramePool *fp = frame_pool_filling;
+
+	__sync_fetch_and_add(&alloc_stats.buffers, 1);
+	if(fp) {
+		__sync_fetch_and_add(&fp->bytes, size);
+		if(fp->usage)
+			mem_charge(fp->usage, size);
+	}
+	return av_buffer_alloc(size);
+}
+
+/* buffers still referenced are freed when they come back */
+static void frame_pool_uninit(FramePool *fp) {
+
+	int i;
+
+	for(i = 0; i < 4; i++)
+		av_buffer_pool_uninit(&fp->pools[i]);
+	if(fp->usage)
+		mem_charge(fp->usage, -fp->bytes);
+	fp->bytes = 0;
+	fp->nb_planes = 0;
+	fp->width = fp->height = 0;
+}
+
+/* Attach pooled buffers for a 'width' x 'height' picture of frame->format
+   to 'frame'; width and height may be padded beyond the visible size. */
+static int frame_pool_get(FramePool *fp, AVFrame *frame, int width, int height) {
+
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+	int i, h;
+
+	if(!desc || (desc->flags & AV_PIX_FMT_FLAG_PAL))
+		return -1;
+	if(fp->format != frame->format || fp->width != width || fp->height != height) {
+		frame_pool_uninit(fp);
+		if(av_image_fill_linesizes(fp->linesize, frame->format, width) < 0)
+			return -1;
+		for(i = 0; i < 4 && fp->linesize[i]; i++) {
+			fp->linesize[i] = FFALIGN(fp->linesize[i], FRAME_POOL_ALIGN);
+			h = (i == 1 || i == 2) ? -((-height) >> desc->log2_chroma_h) : height;
+			/* padding for SIMD readers running past the last pixel */
+			fp->pools[i] = av_buffer_pool_init(fp->linesize[i] * h + 16 + FRAME_POOL_ALIGN, frame_pool_buffer_alloc);
+			if(!fp->pools[i]) {
+				frame_pool_uninit(fp);
+				return -1;
+			}
+		}
+		fp->nb_planes = i;
+		fp->format = frame->format;
+		fp->width = width;
+		fp->height = height;
+	}
+	frame_pool_filling = fp;
+	__sync_fetch_and_add(&alloc_stats.refs, fp->nb_planes);
+	for(i = 0; i < fp->nb_planes; i++) {
+		frame->buf[i] = av_buffer_pool_get(fp->pools[i]);
+		if(!frame->buf[i]) {
+			frame_pool_filling = NULL;
+			av_frame_unref(frame);
+			return -1;
+		}
+		frame->data[i] = frame->buf[i]->data;
+		frame->linesize[i] = fp->linesize[i];
+	}
+	frame_pool_filling = NULL;
+	frame->extended_data = frame->data;
+	return 0;
+}
+
+void packet_queue_init(PacketQueue *q) {
+
+	memset(q, 0, sizeof(PacketQueue));
+	q->mutex = SDL_CreateMutex();
+	q->cond = SDL_CreateCond();
+}
+
+int packet_queue_put(PacketQueue *q, AVPacket *pkt) {
+
+	PacketList *pkt1;
+	if(pkt != &flush_pkt && pkt != &switch_pkt && pkt != &eof_pkt && pkt != &loop_pkt && av_dup_packet(pkt) < 0) {
+		return -1;
+	}
+	pkt1 = av_malloc(sizeof(PacketList));
+	if (!pkt1)
+		return -1;
+	pkt1->pkt = *pkt;
+	pkt1->arrival = av_gettime();
+	pkt1->next = NULL;
+
+	SDL_LockMutex(q->mutex);
+
+	if (!q->last_pkt)
+		q->first_pkt = pkt1;
+	else
+		q->last_pkt->next = pkt1;
+	q->last_pkt = pkt1;
+	q->nb_packets++;
+	q->size += pkt1->pkt.size;
+	q->duration += pkt1->pkt.duration;
+	SDL_CondSignal(q->cond);
+
+	SDL_UnlockMutex(q->mutex);
+	return 0;
+}
+
+static int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block)
+{
+	PacketList *pkt1;
+	int ret;
+
+	SDL_LockMutex(q->mutex);
+
+	for(;;) {
+
+		if(q->abort_request) {
+			ret = -1;
+			break;
+		}
+
+		pkt1 = q->first_pkt;
+		if (pkt1) {
+			q->first_pkt = pkt1->next;
+			if (!q->first_pkt)
+				q->last_pkt = NULL;
+			q->nb_packets--;
+			q->size -= pkt1->pkt.size;
+			q->duration -= pkt1->pkt.duration;
+			*pkt = pkt1->pkt;
+			q->last_arrival = pkt1->arrival;
+			av_free(pkt1);
+			ret = 1;
+			break;
+		}
+		else if (!block) {
+			ret = 0;
+			break;
+		}
+		else {
+			SDL_CondWait(q->cond, q->mutex);
+		}
+	}
+	SDL_UnlockMutex(q->mutex);
+	return ret;
+}
+
+/* returns the number of playlist switch markers that were dropped so the
+   caller can put them back */
+static int packet_queue_flush(PacketQueue *q) {
+
+	PacketList *pkt, *pkt1;
+	int switches = 0;
+
+	SDL_LockMutex(q->mutex);
+	for(pkt = q->first_pkt; pkt != NULL; pkt = pkt1) {
+		pkt1 = pkt->next;
+		if(pkt->pkt.data == switch_pkt.data)
+			switches++;
+		av_free_packet(&pkt->pkt);
+		av_freep(&pkt);
+	}
+	q->last_pkt = NULL;
+	q->first_pkt = NULL;
+	q->nb_packets = 0;
+	q->size = 0;
+	q->duration = 0;
+	SDL_UnlockMutex(q->mutex);
+	return switches;
+}
+
+/* wake and turn away everyone waiting on the queue, for good */
+static void packet_queue_abort(PacketQueue *q) {
+
+	SDL_LockMutex(q->mutex);
+	q->abort_request = 1;
+	SDL_CondBroadcast(q->cond);
+	SDL_UnlockMutex(q->mutex);
+}
+
+static void packet_queue_destroy(PacketQueue *q) {
+
+	packet_queue_flush(q);
+	SDL_DestroyMutex(q->mutex);
+	SDL_DestroyCond(q->cond);
+}
+
+/* seconds of media currently buffered in the queue */
+static double packet_queue_duration(PacketQueue *q) {
+
+	return q->duration * av_q2d(q->time_base);
+}
+
+/* bytes, packets and seconds of a queue, taken together under its lock */
+static void packet_queue_level(PacketQueue *q, int *size, int *nb_packets, double *duration) {
+
+	SDL_LockMutex(q->mutex);
+	*size = q->size;
+	*nb_packets = q->nb_packets;
+	*duration = packet_queue_duration(q);
+	SDL_UnlockMutex(q->mutex);
+}
+
+/* -membudget: the input rate of the item a channel now reads, the
+   share of the budget its packet queues get follows it */
+static void channel_set_byte_rate(VideoState *is, MediaSource *src) {
+
+	AVCodecContext *v = src->pFormatCtx->streams[src->videoStream]->codec;
+	int64_t rate;
+
+	if(src->pFormatCtx->bit_rate > 0)
+		rate = src->pFormatCtx->bit_rate / 8;
+	else
+		rate = (int64_t)v->width * v->height * EST_BITS_PER_PIXEL / 8;
+	rate = FFMAX(rate, 1);
+	__sync_fetch_and_add(&mem_budget.rate, rate - is->byte_rate);
+	is->byte_rate = rate;
+}
+
+/* bytes a channel holds besides its packet queues: decoder and filter
+   pools of all its items, the overlays, the decoded audio, the preloaded
+   item and the loop caches. Counted where they are allocated, so any
+   thread can ask without a lock. */
+static int64_t channel_fixed_memory(VideoState *is) {
+
+	return is->mem_frames + is->mem_overlays + is->mem_audio + is->mem_cache;
+}
+
+/* overlays come and go on the event thread: keep mem_overlays right */
+static void overlay_free(VideoState *is, SDL_Overlay *bmp) {
+
+	mem_charge(&is->mem_overlays, -(int64_t)bmp->w * bmp->h * 3 / 2);
+	SDL_FreeYUVOverlay(bmp);
+}
+
+/* Packet bytes a channel may queue under -membudget. What every channel
+   of every engine holds besides its queues is what the decoders need and
+   is charged first; what is left is divided between the channels in
+   proportion to their input rate, so a 4K channel gets the room a 480p
+   one does not need. */
+static int64_t channel_queue_limit(VideoState *is) {
+
+	int64_t fixed, left;
+
+	if(!mem_budget.budget)
+		return MAX_QUEUE_SIZE;
+	fixed = mem_budget.fixed;
+	left = mem_budget.budget - fixed;
+	if(left < 2 * MIN_QUEUE_BUDGET && __sync_bool_compare_and_swap(&mem_budget.warned, 0, 1))
+		fprintf(stderr, "Memory budget of %"PRId64" MB is too small: the pictures and caches alone take %"PRId64" MB\n",
+				mem_budget.budget >> 20, fixed >> 20);
+	return FFMAX(left * is->byte_rate / FFMAX(mem_budget.rate, 1), MIN_QUEUE_BUDGET);
+}
+
+/* Should the demuxer stop reading? True when the queues exceed the byte
+   cap (channel_queue_limit), which always applies, or when they hold
+   more than 'limit' seconds. Below the byte cap, a queue that runs empty
+   lets the demuxer continue so badly interleaved files cannot starve one
+   decoder while the other queue is full. */
+static int stream_queues_full(VideoState *is, double limit) {
+
+	int asize, vsize, apackets, vpackets;
+	double aduration, vduration;
+
+	packet_queue_level(&is->audioq, &asize, &apackets, &aduration);
+	packet_queue_level(&is->videoq, &vsize, &vpackets, &vduration);
+	if(asize + vsize > channel_queue_limit(is))
+		return 1;
+	/* a live source does not wait for us: only the byte cap holds it
+	   back, pictures that fall behind are dropped further down */
+	if(is->engine->cfg.live || apackets == 0 || vpackets == 0)
+		return 0;
+	return aduration > limit || vduration > limit;
+}
+
+/* called by the consumers after taking a packet: wake the demuxer once
+   the queues have drained below the low-water mark */
+static void demux_wake(VideoState *is) {
+
+	SDL_LockMutex(is->read_mutex);
+	if(is->read_waiting && !stream_queues_full(is, MIN_QUEUE_DURATION))
+		SDL_CondSignal(is->read_cond);
+	SDL_UnlockMutex(is->read_mutex);
+}
+
+/* unconditionally wake the demuxer and the playlist thread (seek request or quit) */
+static void demux_signal(VideoState *is) {
+
+	SDL_LockMutex(is->read_mutex);
+	SDL_CondSignal(is->read_cond);
+	if(is->preload_cond)
+		SDL_CondSignal(is->preload_cond);
+	SDL_UnlockMutex(is->read_mutex);
+}
+
+/* drop one reference to a playlist item; closing the demuxer can block on
+   I/O so the last reference hands it to the playlist thread */
+static void source_release(VideoState *is, MediaSource *src) {
+
+	if(__sync_sub_and_fetch(&src->refcount, 1) > 0)
+		return;
+	SDL_LockMutex(is->read_mutex);
+	src->retired_next = is->retired;
+	is->retired = src;
+	if(is->preload_cond)
+		SDL_CondSignal(is->preload_cond);
+	SDL_UnlockMutex(is->read_mutex);
+}
+
+/* a decoder reached a switch marker: move on to the next item */
+static MediaSource *source_advance(VideoState *is, MediaSource *src) {
+
+	MediaSource *next = src->next;
+	source_release(is, src);
+	return next;
+}
+
+/* audio decoder at a switch marker: an item without sound keeps the
+   stream of the one before, for the format of the silence it plays */
+static void audio_advance(VideoState *is) {
+
+	is->audio_src = source_advance(is, is->audio_src);
+	if(is->audio_src->audioStream >= 0)
+		is->audio_st = is->audio_src->pFormatCtx->streams[is->audio_src->audioStream];
+}
+
+/* the item the audio decoder is on has no sound, and its pictures are
+   still being decoded: the markers after it must wait. Exports are not
+   paced by a clock and go on to the next sound at once. */
+static int audio_silent(VideoState *is) {
+
+	return is->audio_src->audioStream < 0 && !is->audio_src->video_done && !is->engine->cfg.export_filename;
+}
+
+double get_audio_clock(VideoState *is) {
+
+	double pts;
+	int hw_buf_size, bytes_per_sec, n;
+
+	pts = is->audio_clock; /* maintained in the audio thread */
+	hw_buf_size = is->audio_buf_size - is->audio_buf_index;
+	bytes_per_sec = 0;
+	n = is->audio_st->codec->channels * 2;
+	if(is->audio_st) {
+		bytes_per_sec = is->audio_st->codec->sample_rate * n;
+	}
+	if(bytes_per_sec) {
+		/* the bytes not heard yet were stretched: each stands for 'speed'
+		   of them in the media, plus what the stretch holds back */
+		pts -= (double)hw_buf_size / bytes_per_sec * is->stretch.speed;
+		pts -= (double)is->stretch.in_frames * n / bytes_per_sec;
+	}
+	return pts;
+}
+
+/* Microseconds on the clock that paces playback: the wall clock, or the
+   time the scheduler has reached on a virtual clock (player_simulate). */
+static int64_t engine_time(PlayerEngine *e) {
+
+	return e->virtual_clock ? e->virtual_time : av_gettime();
+}
+
+double get_video_clock(VideoState *is) {
+
+	double delta;
+
+	if(is->engine->paused)
+		return is->video_current_pts;
+	delta = (engine_time(is->engine) - is->video_current_pts_time) / 1000000.0;
+	return is->video_current_pts + delta * is->engine->speed;
+}
+
+/* the clock of the engine: both channels follow it in lock mode */
+double get_external_clock(VideoState *is) {
+
+	PlayerEngine *e = is->engine;
+
+	if(!e->clock_time)
+		return get_video_clock(is);
+	return e->clock_pts + ((e->paused ? e->pause_time : engine_time(e)) - e->clock_time) / 1000000.0 * e->speed;
+}
+
+double get_master_clock(VideoState *is) {
+
+	if(is->av_sync_type == AV_SYNC_VIDEO_MASTER) return get_video_clock(is);
+	else if(is->av_sync_type == AV_SYNC_AUDIO_MASTER) return get_audio_clock(is);
+	else return get_external_clock(is);
+}
+
+/* Add or subtract samples to get a better sync, return new
+   audio buffer size */
+int synchronize_audio(VideoState *is, short *samples,int samples_size, double pts) {
+
+	int n, in_size = samples_size;
+	double diff = 0;
+
+	n = 2 * is->audio_st->codec->channels;
+
+	if(is->av_sync_type != AV_SYNC_AUDIO_MASTER) {
+		double avg_diff, nosync_threshold;
+		int wanted_size, min_size, max_size /*, nb_samples */;
+
+		diff = get_audio_clock(is) - get_master_clock(is);
+		/* at the seam of an A-B loop the sound is back at A a few
+		   pictures before the video: nothing to correct */
+		nosync_threshold = is->loop_b > 0 ? FFMIN(is->engine->nosync_threshold, LOOP_NOSYNC_THRESHOLD) :
+				is->engine->nosync_threshold;
+
+		if(fabs(diff) < nosync_threshold) {
+			// accumulate the diffs
+			is->audio_diff_cum = diff + is->audio_diff_avg_coef * is->audio_diff_cum;
+			if(is->audio_diff_avg_count < AUDIO_DIFF_AVG_NB) {
+				is->audio_diff_avg_count++;
+			}
+			else {
+				avg_diff = is->audio_diff_cum * (1.0 - is->audio_diff_avg_coef);
+				if(fabs(avg_diff) >= is->audio_diff_threshold) {
+					wanted_size = samples_size + ((int)(diff * is->audio_st->codec->sample_rate) * n);
+					/* at most a few percent faster or slower, whole samples only */
+					min_size = samples_size * (100 - SAMPLE_CORRECTION_PERCENT_MAX) / 100 / n * n;
+					max_size = samples_size * (100 + SAMPLE_CORRECTION_PERCENT_MAX) / 100 / n * n;
+					if(wanted_size < min_size) {
+						wanted_size = min_size;
+					}
+					else if (wanted_size > max_size) {
+						wanted_size = max_size;
+					}
+					if(wanted_size < samples_size) {
+						/* remove samples */
+						samples_size = wanted_size;
+					}
+					else if(wanted_size > samples_size) {
+						uint8_t *samples_end, *q;
+						int nb;
+
+						/* add samples by copying final sample*/
+						nb = (wanted_size - samples_size);
+						samples_end = (uint8_t *)samples + samples_size - n;
+						q = samples_end + n;
+						while(nb > 0) {
+							memcpy(q, samples_end, n);
+							q += n;
+							nb -= n;
+						}
+						samples_size = wanted_size;
+					}
+				}
+			}
+		}
+		else {
+			/* difference is TOO big; reset diff stuff */
+			is->audio_diff_avg_count = 0;
+			is->audio_diff_cum = 0;
+		}
+	}
+	if(is->engine->virtual_log)
+		fprintf(is->engine->virtual_log, "%.6f %d audio %.6f diff %+.6f samples %d %d\n",
+				engine_time(is->engine) / 1000000.0, is->is_small ? 2 : 1, get_audio_clock(is), diff,
+				in_size / n, samples_size / n);
+	return samples_size;
+}
+
+/* make room for 'size' bytes of samples in audio_buf, plus what
+   synchronize_audio may add to them */
+static int audio_buf_reserve(VideoState *is, int size) {
+
+	unsigned int old = is->audio_buf_alloc;
+
+	av_fast_malloc(&is->audio_buf, &is->audio_buf_alloc, size + size * SAMPLE_CORRECTION_PERCENT_MAX / 100 + 64);
+	mem_charge(&is->mem_audio, (int64_t)is->audio_buf_alloc - old);
+	return is->audio_buf ? 0 : -1;
+}
+
+/* forget the input held back: after seeks and skips */
+static void stretch_reset(TimeStretch *ts) {
+
+	ts->in_frames = 0;
+	ts->skip_frac = 0;
+	ts->have_mid = 0;
+}
+
+static void stretch_free(TimeStretch *ts) {
+
+	av_freep(&ts->in);
+	av_freep(&ts->mid);
+	av_freep(&ts->window);
+	av_freep(&ts->out);
+	ts->in_alloc = ts->out_alloc = 0;
+}
+
+static int stretch_setup(TimeStretch *ts, int channels, int rate) {
+
+	int i, j, w;
+
+	ts->channels = channels;
+	ts->rate = rate;
+	ts->sequence = rate * STRETCH_SEQUENCE_MS / 1000;
+	ts->overlap = FFALIGN(rate * STRETCH_OVERLAP_MS / 1000, 8);	/* whole registers */
+	ts->seek = rate * STRETCH_SEEK_MS / 1000;
+	ts->corr_shift = av_log2(ts->overlap * channels / 8) + 1;
+	av_freep(&ts->mid);
+	av_freep(&ts->window);
+	ts->mid = av_malloc(ts->overlap * channels * sizeof(int16_t));
+	ts->window = av_malloc(2 * ts->overlap * channels * sizeof(int16_t));
+	stretch_reset(ts);
+	if(!ts->mid || !ts->window) {
+		ts->channels = 0;
+		return -1;
+	}
+	for(i = 0; i < ts->overlap; i++) {
+		w = (i * 16384 + ts->overlap / 2) / ts->overlap;
+		for(j = 0; j < channels; j++) {
+			ts->window[2 * (i * channels + j)] = 16384 - w;
+			ts->window[2 * (i * channels + j) + 1] = w;
+		}
+	}
+	return 0;
+}
+
+/* how well the input at 'in' continues the previous piece: their
+   correlation over the overlap, normalized by the energy of the input */
+static double stretch_corr(const TimeStretch *ts, const int16_t *in) {
+
+	const int16_t *mid = ts->mid;
+	int64_t corr = 0, energy = 0;
+	int i, len = ts->overlap * ts->channels;
+
+#ifdef __SSE2__
+	__m128i c = _mm_setzero_si128(), e = c, shift = _mm_cvtsi32_si128(ts->corr_shift), a, b;
+	int32_t lanes[8];
+
+	for(i = 0; i < len; i += 8) {
+		a = _mm_loadu_si128((const __m128i *)(mid + i));
+		b = _mm_loadu_si128((const __m128i *)(in + i));
+		c = _mm_add_epi32(c, _mm_sra_epi32(_mm_madd_epi16(a, b), shift));
+		e = _mm_add_epi32(e, _mm_sra_epi32(_mm_madd_epi16(b, b), shift));
+	}
+	_mm_storeu_si128((__m128i *)lanes, c);
+	_mm_storeu_si128((__m128i *)(lanes + 4), e);
+	for(i = 0; i < 4; i++) {
+		corr += lanes[i];
+		energy += lanes[i + 4];
+	}
+#else
+	for(i = 0; i < len; i++) {
+		corr += mid[i] * in[i];
+		energy += in[i] * in[i];
+	}
+#endif
+	return corr / sqrt(energy + 1.0);
+}
+
+/* the end of the previous piece fading out into 'in' fading in, over the
+   overlap: one multiply-add per pair of samples with the window */
+static void stretch_crossfade(const TimeStretch *ts, int16_t *dst, const int16_t *in) {
+
+	const int16_t *mid = ts->mid, *w = ts->window;
+	int i, len = ts->overlap * ts->channels;
+
+#ifdef __SSE2__
+	__m128i round = _mm_set1_epi32(1 << 13), a, b, lo, hi;
+
+	for(i = 0; i < len; i += 8) {
+		a = _mm_loadu_si128((const __m128i *)(mid + i));
+		b = _mm_loadu_si128((const __m128i *)(in + i));
+		lo = _mm_madd_epi16(_mm_unpacklo_epi16(a, b), _mm_loadu_si128((const __m128i *)(w + 2 * i)));
+		hi = _mm_madd_epi16(_mm_unpackhi_epi16(a, b), _mm_loadu_si128((const __m128i *)(w + 2 * i + 8)));
+		lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 14);
+		hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 14);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(lo, hi));
+	}
+#else
+	for(i = 0; i < len; i++)
+		dst[i] = (mid[i] * w[2 * i] + in[i] * w[2 * i + 1] + (1 << 13)) >> 14;
+#endif
+}
+
+/* Time-stretch 'size' bytes of interleaved S16 to 'speed' at the same
+   pitch (WSOLA): pieces of 'sequence' frames are taken from the input
+   every speed * (sequence - overlap) frames, each where it continues the
+   previous one best within 'seek' frames, and crossfaded over 'overlap'
+   frames. Returns the bytes of output in ts->out: none until enough
+   input came, and at speed 1 what was held back and the input as it is,
+   the end of the last piece faded into it. -1 when out of memory. */
+static int stretch_process(TimeStretch *ts, const uint8_t *samples, int size, int channels, int rate, double speed) {
+
+	int n = channels, frames = size / (2 * channels), piece, need, best, skip, k;
+	double nominal, score, best_score = 0;
+	int16_t *in, *dst;
+
+	if((channels != ts->channels || rate != ts->rate) && stretch_setup(ts, channels, rate) < 0)
+		return -1;
+	/* what is held back stays */
+	in = av_fast_realloc(ts->in, &ts->in_alloc, (ts->in_frames + frames) * n * sizeof(int16_t));
+	if(!in)
+		return -1;
+	ts->in = in;
+	memcpy(ts->in + ts->in_frames * n, samples, frames * n * sizeof(int16_t));
+	ts->in_frames += frames;
+	ts->speed = speed;
+	if(speed == 1.0) {
+		/* the last piece ended on mid: without the fade the input
+		   would start with a step */
+		if(ts->have_mid && ts->in_frames < ts->overlap)
+			return 0;
+		size = ts->in_frames * n * sizeof(int16_t);
+		av_fast_malloc(&ts->out, &ts->out_alloc, size);
+		if(!ts->out)
+			return -1;
+		memcpy(ts->out, ts->in, size);
+		if(ts->have_mid)
+			stretch_crossfade(ts, (int16_t *)ts->out, ts->in);
+		stretch_reset(ts);
+		return size;
+	}
+
+	piece = ts->sequence - ts->overlap;
+	nominal = speed * piece;
+	need = FFMAX((int)nominal + ts->overlap, ts->sequence) + ts->seek;
+	if(ts->in_frames < need)
+		return 0;
+	av_fast_malloc(&ts->out, &ts->out_alloc, ((ts->in_frames - need) / (int)nominal + 1) * piece * n * sizeof(int16_t));
+	if(!ts->out)
+		return -1;
+	dst = (int16_t *)ts->out;
+	while(ts->in_frames >= need) {
+		best = 0;
+		if(!ts->have_mid)
+			memcpy(dst, ts->in, ts->overlap * n * sizeof(int16_t));
+		else {
+			for(k = 0; k < ts->seek; k++) {
+				score = stretch_corr(ts, ts->in + k * n);
+				if(!k || score > best_score) {
+					best_score = score;
+					best = k;
+				}
+			}
+			stretch_crossfade(ts, dst, ts->in + best * n);
+		}
+		memcpy(dst + ts->overlap * n, ts->in + (best + ts->overlap) * n, (piece - ts->overlap) * n * sizeof(int16_t));
+		memcpy(ts->mid, ts->in + (best + piece) * n, ts->overlap * n * sizeof(int16_t));
+		ts->have_mid = 1;
+		dst += piece * n;
+
+		ts->skip_frac += nominal;
+		skip = (int)ts->skip_frac;
+		ts->skip_frac -= skip;
+		ts->in_frames -= skip;
+		memmove(ts->in, ts->in + skip * n, ts->in_frames * n * sizeof(int16_t));
+	}
+	return (uint8_t *)dst - ts->out;
+}
+
+/* audio callback: the decoded samples in audio_buf, at the speed of the
+   engine; the new size, 0 while the stretch waits for more */
+static int stretch_audio(VideoState *is, int size) {
+
+	TimeStretch *ts = &is->stretch;
+	double speed = is->engine->speed;
+	int64_t old = (int64_t)ts->in_alloc + ts->out_alloc;
+
+	if(speed == 1.0 && ts->speed == 1.0 && !ts->in_frames)
+		return size;
+	size = stretch_process(ts, is->audio_buf, size, is->audio_st->codec->channels,
+			is->audio_st->codec->sample_rate, speed);
+	mem_charge(&is->mem_audio, (int64_t)ts->in_alloc + ts->out_alloc - old);
+	if(size > 0) {
+		if(audio_buf_reserve(is, size) < 0)
+			size = -1;
+		else
+			memcpy(is->audio_buf, ts->out, size);
+	}
+	if(size < 0) {
+		/* out of memory: this buffer is lost, the next starts over */
+		stretch_reset(ts);
+		size = 0;
+	}
+	return size;
+}
+
+int decode_frame_from_packet(VideoState *is, AVFrame decoded_frame)
+{
+	int64_t src_ch_layout, dst_ch_layout;
+	int src_rate, dst_rate;
+	uint8_t **src_data = NULL, **dst_data = NULL;
+	int src_nb_channels = 0, dst_nb_channels = 0;
+	int src_linesize, dst_linesize;
+	int src_nb_samples, dst_nb_samples;
+	enum AVSampleFormat src_sample_fmt, dst_sample_fmt;
+	int dst_bufsize;
+	int ret;
+
+	src_nb_samples = decoded_frame.nb_samples;
+	src_linesize = (int) decoded_frame.linesize[0];
+	src_data = decoded_frame.data;
+
+	if (decoded_frame.channel_layout == 0) {
+		decoded_frame.channel_layout = av_get_default_channel_layout(decoded_frame.channels);
+	}
+
+	src_rate = decoded_frame.sample_rate;
+	dst_rate = decoded_frame.sample_rate;
+	src_ch_layout = decoded_frame.channel_layout;
+	dst_ch_layout = decoded_frame.channel_layout;
+	src_sample_fmt = decoded_frame.format;
+	dst_sample_fmt = AV_SAMPLE_FMT_S16;
+
+	av_opt_set_int(is->sws_ctx_audio, "in_channel_layout", src_ch_layout, 0);
+	av_opt_set_int(is->sws_ctx_audio, "out_channel_layout", dst_ch_layout,  0);
+	av_opt_set_int(is->sws_ctx_audio, "in_sample_rate", src_rate, 0);
+	av_opt_set_int(is->sws_ctx_audio, "out_sample_rate", dst_rate, 0);
+	av_opt_set_sample_fmt(is->sws_ctx_audio, "in_sample_fmt", src_sample_fmt, 0);
+	av_opt_set_sample_fmt(is->sws_ctx_audio, "out_sample_fmt", dst_sample_fmt,  0);
+
+	/* initialize the resampling context */
+	if ((ret = swr_init((void*)is->sws_ctx_audio)) < 0) {
+		fprintf(stderr, "Failed to initialize the resampling context\n");
+		return -1;
+	}
+
+	/* allocate source and destination samples buffers */
+	src_nb_channels = av_get_channel_layout_nb_channels(src_ch_layout);
+	ret = av_samples_alloc_array_and_samples(&src_data, &src_linesize, src_nb_channels, src_nb_samples, src_sample_fmt, 0);
+	if (ret < 0) {
+		fprintf(stderr, "Could not allocate source samples\n");
+		return -1;
+	}
+
+	/* compute the number of converted samples: buffering is avoided
+	 * ensuring that the output buffer will contain at least all the
+	 * converted input samples */
+	dst_nb_samples = av_rescale_rnd(src_nb_samples, dst_rate, src_rate, AV_ROUND_UP);
+
+	/* buffer is going to be directly written to a rawaudio file, no alignment */
+	dst_nb_channels = av_get_channel_layout_nb_channels(dst_ch_layout);
+	ret = av_samples_alloc_array_and_samples(&dst_data, &dst_linesize, dst_nb_channels, dst_nb_samples, dst_sample_fmt, 0);
+	if (ret < 0) {
+		fprintf(stderr, "Could not allocate destination samples\n");
+		return -1;
+	}
+
+	/* compute destination number of samples */
+	dst_nb_samples = av_rescale_rnd(swr_get_delay((void*)is->sws_ctx_audio, src_rate) + src_nb_samples, dst_rate, src_rate, AV_ROUND_UP);
+
+	/* convert to destination format */
+	ret = swr_convert((void*)is->sws_ctx_audio,dst_data,dst_nb_samples,(const uint8_t **)decoded_frame.data, src_nb_samples);
+	if (ret < 0) {
+		fprintf(stderr, "Error while converting\n");
+		return -1;
+	}
+
+	dst_bufsize = av_samples_get_buffer_size(&dst_linesize, dst_nb_channels, ret, dst_sample_fmt, 1);
+	if (dst_bufsize < 0) {
+		fprintf(stderr, "Could not get sample buffer size\n");
+		return -1;
+	}
+
+	if(audio_buf_reserve(is, dst_bufsize) < 0)
+		dst_bufsize = -1;
+	else
+		memcpy(is->audio_buf, dst_data[0], dst_bufsize);
+
+	if (src_data) {
+		av_freep(&src_data[0]);
+	}
+	av_freep(&src_data);
+
+	if (dst_data) {
+		av_freep(&dst_data[0]);
+	}
+	av_freep(&dst_data);
+
+	return dst_bufsize;
+}
+
+int audio_decode_frame(VideoState *is, double *pts_ptr) {
+
+	int len1, data_size = 0, n;
+	AVPacket *pkt = &is->audio_pkt;
+	double pts;
+
+	for(;;) {
+		while(is->audio_pkt_size > 0) {
+			int got_frame = 0;
+			len1 = avcodec_decode_audio4(is->audio_st->codec, &is->audio_frame, &got_frame, pkt);
+			if(len1 < 0) {
+				/* if error, skip frame */
+				is->audio_pkt_size = 0;
+				break;
+			}
+			if (got_frame) {
+				if (is->audio_frame.format != AV_SAMPLE_FMT_S16) {
+					data_size = decode_frame_from_packet(is, is->audio_frame);
+				}
+				else {
+					data_size =
+							av_samples_get_buffer_size
+							(
+									NULL,
+									is->audio_st->codec->channels,
+									is->audio_frame.nb_samples,
+									is->audio_st->codec->sample_fmt,
+									1
+							);
+					if(audio_buf_reserve(is, data_size) < 0)
+						data_size = -1;
+					else
+						memcpy(is->audio_buf, is->audio_frame.data[0], data_size);
+				}
+			}
+			is->audio_pkt_data += len1;
+			is->audio_pkt_size -= len1;
+			if(data_size <= 0) {
+				/* No data yet, get more frames */
+				continue;
+			}
+			pts = is->audio_clock;
+			*pts_ptr = pts;
+			n = 2 * is->audio_st->codec->channels;
+			is->audio_clock += (double)data_size /
+					(double)(n * is->audio_st->codec->sample_rate);
+
+			/* We have data, return it and come back for more later */
+			return data_size;
+		}
+		if(pkt->data)
+			av_free_packet(pkt);
+
+		if(is->quit || is->audio_eof) {
+			return -1;
+		}
+		if(audio_silent(is)) {
+			/* silence on the clock of the pictures, as long as they last */
+			n = 2 * is->audio_st->codec->channels;
+			data_size = SDL_AUDIO_BUFFER_SIZE * n;
+			if(audio_buf_reserve(is, data_size) < 0)
+				return -1;
+			memset(is->audio_buf, 0, data_size);
+			is->audio_clock = get_video_clock(is);
+			*pts_ptr = is->audio_clock;
+			is->audio_clock += (double)SDL_AUDIO_BUFFER_SIZE / is->audio_st->codec->sample_rate;
+			return data_size;
+		}
+		/* next packet */
+		if(packet_queue_get(&is->audioq, pkt, 1) < 0) {
+			return -1;
+		}
+		demux_wake(is);
+		if(pkt->data == flush_pkt.data) {
+			avcodec_flush_buffers(is->audio_st->codec);
+			stretch_reset(&is->stretch);
+			continue;
+		}
+		if(pkt->data == eof_pkt.data) {
+			/* export mode: the channel ended */
+			pkt->data = NULL;
+			is->audio_eof = 1;
+			return -1;
+		}
+		if(pkt->data == switch_pkt.data) {
+			/* next playlist item: keep going on its decoder, no flush */
+			audio_advance(is);
+			continue;
+		}
+		is->audio_pkt_data = pkt->data;
+		is->audio_pkt_size = pkt->size;
+		/* if update, update the audio clock w/pts */
+		if(pkt->pts != AV_NOPTS_VALUE) {
+			is->audio_clock = av_q2d(is->audio_st->time_base)*pkt->pts + is->audio_src->pts_offset;
+		}
+	}
+}
+
+void audio_callback(void *userdata, Uint8 *stream, int len) {
+
+	VideoState *is = (VideoState *)userdata;
+	int len1, audio_size;
+	double pts;
+
+	if(is->audio_skipping) {
+		/* heard again: the decoder missed packets */
+		is->audio_skipping = 0;
+		avcodec_flush_buffers(is->audio_st->codec);
+	}
+	while(len > 0) {
+		if(is->audio_buf_index >= is->audio_buf_size) {
+			/* We have already sent all our data; get more. A live channel
+			   stays silent and lets its audio queue up until the jitter
+			   buffer has filled and the first picture is shown. */
+			audio_size = is->engine->cfg.live && !is->live_started ? -1 : audio_decode_frame(is, &pts);
+			/* an underrun is when sound was expected: not before a live
+			   channel starts, not after the end */
+			if(audio_size < 0 && (!is->engine->cfg.live || is->live_started) && !is->audio_eof && !is->quit)
+				is->audio_underruns++;
+			if(audio_size < 0) {
+				/* If error, output silence */
+				if(audio_buf_reserve(is, 1024) < 0) {
+					memset(stream, 0, len);
+					return;
+				}
+				is->audio_buf_size = 1024;
+				memset(is->audio_buf, 0, is->audio_buf_size);
+			}
+			else {
+				audio_size = synchronize_audio(is, (int16_t *)is->audio_buf,audio_size, pts);
+				is->audio_buf_size = stretch_audio(is, audio_size);
+			}
+			is->audio_buf_index = 0;
+		}
+		len1 = is->audio_buf_size - is->audio_buf_index;
+		if(len1 > len)
+			len1 = len;
+		memcpy(stream, (uint8_t *)is->audio_buf + is->audio_buf_index, len1);
+		len -= len1;
+		stream += len1;
+		is->audio_buf_index += len1;
+	}
+}
+
+/* audio callback: copy what is being played for the recorder; when its
+   buffer is full the samples are dropped and counted */
+static void recorder_put_audio(Recorder *rec, const uint8_t *stream, int len) {
+
+	int n, pos;
+
+	pthread_mutex_lock(&rec->audio_mutex);
+	if(!rec->audio_start)
+		rec->audio_start = av_gettime();
+	if(len > rec->audio_ring_size - rec->audio_fill) {
+		rec->audio_dropped += len;
+		len = 0;
+	}
+	pos = (rec->audio_rindex + rec->audio_fill) % rec->audio_ring_size;
+	rec->audio_fill += len;
+	while(len > 0) {
+		n = FFMIN(len, rec->audio_ring_size - pos);
+		memcpy(rec->audio_ring + pos, stream, n);
+		stream += n;
+		len -= n;
+		pos = 0;
+	}
+	pthread_mutex_unlock(&rec->audio_mutex);
+}
+
+/* Audio callback, channel nobody hears: 'len' bytes worth of packets are
+   dropped without decoding them, so the demuxer keeps reading and the
+   audio clock is right when the channel is heard again. */
+static void audio_skip(VideoState *is, int len) {
+
+	AVPacket *pkt = &is->audio_pkt;
+	double end, duration;
+
+	if(!is->audio_st || audio_silent(is))
+		return;
+	is->audio_skipping = 1;
+	is->audio_buf_size = is->audio_buf_index = 0;
+	is->audio_pkt_size = 0;
+	stretch_reset(&is->stretch);
+	end = is->audio_clock + (double)len / (2 * is->audio_st->codec->channels * is->audio_st->codec->sample_rate) *
+			is->engine->speed;
+	while(is->audio_clock < end) {
+		if(pkt->data)
+			av_free_packet(pkt);
+		if(packet_queue_get(&is->audioq, pkt, 0) <= 0)
+			break;
+		demux_wake(is);
+		if(pkt->data == flush_pkt.data) {
+			avcodec_flush_buffers(is->audio_st->codec);
+			continue;
+		}
+		if(pkt->data == eof_pkt.data) {
+			pkt->data = NULL;
+			break;
+		}
+		if(pkt->data == switch_pkt.data) {
+			audio_advance(is);
+			if(audio_silent(is))
+				break;
+			continue;
+		}
+		duration = pkt->duration > 0 ? pkt->duration * av_q2d(is->audio_st->time_base) :
+				(double)SDL_AUDIO_BUFFER_SIZE / is->audio_st->codec->sample_rate;
+		if(pkt->pts != AV_NOPTS_VALUE)
+			is->audio_clock = av_q2d(is->audio_st->time_base) * pkt->pts + is->audio_src->pts_offset;
+		is->audio_clock += duration;
+	}
+	if(pkt->data)
+		av_free_packet(pkt);
+}
+
+void audio_callback_manager(void *userdata, Uint8 *stream, int len) {
+
+	VideoState* is = (VideoState*) userdata;
+	VideoState *heard = is->flag_sound == 2 ? is->is2 : is;
+
+	/* only the channel being heard is decoded; muted, neither is */
+	audio_skip(heard == is ? is->is2 : is, len);
+	if(is->engine->mute)
+		audio_skip(heard, len);
+	else
+		audio_callback(heard, stream, len);
+	if(is->engine->recorder)
+		recorder_put_audio(is->engine->recorder, stream, len);
+}
+
+/* virtual clock: the next refresh of the channel is due at 'time', -1
+   for now */
+static void virtual_schedule(VideoState *is, int64_t time) {
+
+	PlayerEngine *e = is->engine;
+
+	SDL_LockMutex(e->virtual_mutex);
+	is->refresh_due = time < 0 ? e->virtual_time : time;
+	SDL_CondSignal(e->virtual_cond);
+	SDL_UnlockMutex(e->virtual_mutex);
+}
+
+/* ask the event thread for a video refresh now */
+static void push_refresh(VideoState *is) {
+
+	SDL_Event event;
+
+	if(is->engine->virtual_clock) {
+		virtual_schedule(is, -1);
+		return;
+	}
+	event.type = FF_REFRESH_EVENT;
+	event.user.data1 = is;
+	SDL_PushEvent(&event);
+}
+
+static Uint32 sdl_refresh_timer_cb(Uint32 interval, void *opaque) {
+
+	push_refresh(opaque);
+	return 0; /* 0 means stop timer */
+}
+
+/* schedule a video refresh in 'delay' ms */
+static void schedule_refresh(VideoState *is, int delay) {
+
+	if(is->engine->virtual_clock) {
+		virtual_schedule(is, engine_time(is->engine) + delay * 1000LL);
+		return;
+	}
+	is->refresh_timer = SDL_AddTimer(delay, sdl_refresh_timer_cb, is);
+}
+
+/* The largest rect with the aspect ratio of the pictures of 'is' centered
+   in 'width' x 'height'. */
+static void video_fit_rect(VideoState *is, int width, int height, SDL_Rect *rect) {
+
+	float aspect_ratio;
+	int w, h, x;
+
+	if(is->video_st->codec->sample_aspect_ratio.num == 0) {
+		aspect_ratio = 0;
+	}
+	else {
+		aspect_ratio = av_q2d(is->video_st->codec->sample_aspect_ratio) *
+				is->video_st->codec->width / is->video_st->codec->height;
+	}
+	if(aspect_ratio <= 0.0) {
+		aspect_ratio = (float)is->video_st->codec->width /
+				(float)is->video_st->codec->height;
+	}
+	h = height;
+	w = ((int)rint(h * aspect_ratio)) & -3;
+	if(w > width) {
+		w = width;
+		h = ((int)rint(w / aspect_ratio)) & -3;
+	}
+	x = (width - w) / 2;
+
+	rect->x = x;
+	rect->y = (height - h) / 2;
+	rect->w = w;
+	rect->h = h;
+}
+
+/* Where the picture of 'is' goes on a 'width' x 'height' canvas (the
+   screen, or the export picture). Returns 0 when the current view does
+   not show this channel. */
+static int video_tile_rect(VideoState *is, int width, int height, SDL_Rect *rect) {
+
+	video_fit_rect(is, width, height, rect);
+	if(is->is_small) {
+		rect->y = 0;
+		rect->h = height/2;
+	}
+	else {
+		rect->y = height/2;
+		rect->h = height/2;
+	}
+	if(is->engine->multi_videos)
+		return 1;
+	if(is->flag_sound == 1 && !is->is_small) {
+		rect->h = height;
+		rect->y = 0;
+		return 1;
+	}
+	if(is->flag_sound == 2 && is->is_small) {
+		rect->h = height;
+		return 1;
+	}
+	return 0;
+}
+
+/* the layout of the screen on a 'width' x 'height' canvas */
+static void composition_layout(Composition *comp, VideoState *channels[2], int width, int height) {
+
+	int c;
+
+	for(c = 0; c < 2; c++) {
+		if(!channels[c]->video_st || !video_tile_rect(channels[c], width, height, &comp->rects[c]))
+			comp->rects[c].w = comp->rects[c].h = 0;
+		comp->color_flags[c] = channels[c]->color_flag;
+	}
+}
+
+/* Draw 'picture' in the 'rect' tile of a YUV420P canvas ('width' x
+   'height' planes in Y, U, V order). A picture of the tile's size in the
+   canvas format is plane-copied, anything else goes through 'sws'.
+   Returns 1 for a copy, 0 when scaled, -1 if nothing was drawn. */
+static int tile_draw(struct SwsContext **sws, const AVFrame *picture, const SDL_Rect *rect, int color_flag,
+		uint8_t *const data[3], const int linesize[3], int width, int height) {
+
+	uint8_t *dst[4] = { NULL };
+	int i, x, y, w, h, copy;
+
+	// 4:2:0 tiles start and end on even lines and columns
+	x = rect->x & ~1;
+	y = rect->y & ~1;
+	w = FFMIN(rect->w, width - x) & ~1;
+	h = FFMIN(rect->h, height - y) & ~1;
+	if(w <= 0 || h <= 0)
+		return -1;
+	dst[0] = data[0] + y * linesize[0] + x;
+	dst[1] = data[1] + y / 2 * linesize[1] + x / 2;
+	dst[2] = data[2] + y / 2 * linesize[2] + x / 2;
+	copy = picture->format == AV_PIX_FMT_YUV420P && picture->width == w && picture->height == h;
+	if(copy) {
+		av_image_copy_plane(dst[0], linesize[0], picture->data[0], picture->linesize[0], w, h);
+		av_image_copy_plane(dst[1], linesize[1], picture->data[1], picture->linesize[1], w / 2, h / 2);
+		av_image_copy_plane(dst[2], linesize[2], picture->data[2], picture->linesize[2], w / 2, h / 2);
+	}
+	else {
+		*sws = sws_getCachedContext(*sws, picture->width, picture->height,
+				picture->format, w, h, AV_PIX_FMT_YUV420P, SWS_BILINEAR, NULL, NULL, NULL);
+		if(!*sws)
+			return -1;
+		sws_scale(*sws, (uint8_t const * const *)picture->data, picture->linesize,
+				0, picture->height, dst, linesize);
+	}
+	if(color_flag == 5) {
+		// the YUV filter is applied on the output, not by toRGB
+		for(i = 0; i < h / 2; i++)
+			memset(dst[1] + i * linesize[1], 100, w / 2);
+	}
+	return copy;
+}
+
+/* Display thread: queue what the screen shows for the recorder. Only
+   references are taken; if the recorder is behind the screen is dropped. */
+static void recorder_capture(Recorder *rec) {
+
+	Composition *comp;
+	int c;
+
+	pthread_mutex_lock(&rec->mutex);
+	if(rec->queue_size >= RECORD_QUEUE_SIZE) {
+		rec->dropped++;
+		pthread_mutex_unlock(&rec->mutex);
+		return;
+	}
+	pthread_mutex_unlock(&rec->mutex);
+
+	/* only this thread fills the slot at windex */
+	comp = &rec->queue[rec->windex];
+	composition_layout(comp, rec->channels, rec->width, rec->height);
+	for(c = 0; c < 2; c++) {
+		if(rec->channels[c]->shown_frame->buf[0])
+			frame_ref(comp->pictures[c], rec->channels[c]->shown_frame);
+	}
+	comp->time = av_gettime();
+	if(++rec->windex == RECORD_QUEUE_SIZE)
+		rec->windex = 0;
+
+	pthread_mutex_lock(&rec->mutex);
+	rec->queue_size++;
+	rec->captured++;
+	pthread_cond_signal(&rec->cond);
+	pthread_mutex_unlock(&rec->mutex);
+}
+
+/* Display thread: hand the pictures on screen to the comparator when they
+   have the same pts and neither was measured yet, and show the last
+   results in the window caption. */
+static void compare_update(PlayerEngine *e) {
+
+	Comparator *cmp = e->comparator;
+	VideoState *a = e->channels[0], *b = e->channels[1];
+	double tolerance;
+	char caption[192];
+	int64_t now;
+	int c;
+
+	tolerance = COMPARE_PTS_TOLERANCE * FFMIN(a->frame_last_delay, b->frame_last_delay);
+	if(a->shown_frame->buf[0] && b->shown_frame->buf[0] &&
+			a->shown_serial != cmp->serials[0] && b->shown_serial != cmp->serials[1] &&
+			fabs(a->video_current_pts - b->video_current_pts) <= FFMAX(tolerance, 0.001)) {
+		cmp->serials[0] = a->shown_serial;
+		cmp->serials[1] = b->shown_serial;
+		pthread_mutex_lock(&cmp->mutex);
+		if(cmp->busy) {
+			cmp->skipped++;
+		}
+		else {
+			for(c = 0; c < 2; c++)
+				frame_ref(cmp->pictures[c], e->channels[c]->shown_frame);
+			cmp->pts = a->video_current_pts;
+			cmp->busy = 1;
+			pthread_cond_signal(&cmp->cond);
+		}
+		pthread_mutex_unlock(&cmp->mutex);
+	}
+
+	now = av_gettime();
+	if(!e->screen || now - cmp->caption_time < COMPARE_CAPTION_INTERVAL)
+		return;
+	cmp->caption_time = now;
+	pthread_mutex_lock(&cmp->mutex);
+	if(cmp->compared)
+		snprintf(caption, sizeof(caption), "PSNR Y %.2f U %.2f V %.2f dB - SSIM Y %.4f U %.4f V %.4f (%d skipped)",
+				cmp->psnr[0], cmp->psnr[1], cmp->psnr[2], cmp->ssim[0], cmp->ssim[1], cmp->ssim[2], cmp->skipped);
+	else
+		snprintf(caption, sizeof(caption), "Comparing: no pictures with the same pts yet");
+	pthread_mutex_unlock(&cmp->mutex);
+	SDL_WM_SetCaption(caption, NULL);
+}
+
+void video_display(VideoState *is) {
+
+	is->engine->renderer->present(is, &is->pictq[is->pictq_rindex]);
+}
+
+/* the steps from the engine's launch to the first picture of a channel */
+static void startup_print(VideoState *is) {
+
+	int64_t launch = is->engine->launch_time;
+
+	fprintf(stderr, "Channel %d: first frame on screen %.1f ms after launch (opened and probed at %.1f ms, "
+			"first picture decoded at %.1f ms)\n", is->is_small ? 2 : 1, (is->first_shown_time - launch) / 1000.0,
+			(is->open_time - launch) / 1000.0, (is->first_picture_time - launch) / 1000.0);
+}
+
+/* a picture of the channel reached the screen: the first one ends the
+   startup */
+static void startup_shown(VideoState *is) {
+
+	if(is->first_shown_time)
+		return;
+	is->first_shown_time = av_gettime();
+	startup_print(is);
+}
+
+/* live mode: latency of the pictures shown since the last report. It is
+   measured from the arrival of their first packet, which on loopback is
+   the whole way from the sender. */
+static void live_report(VideoState *is) {
+
+	if(!is->live_latency_count)
+		return;
+	fprintf(stderr, "Channel %d: end-to-end latency %.1f ms avg, %.1f ms max (target %.0f ms), "
+			"%d late pictures dropped, %d rebuffers\n",
+			is->is_small ? 2 : 1, 1000.0 * is->live_latency_sum / is->live_latency_count,
+			1000.0 * is->live_latency_max, 1000.0 * is->engine->cfg.latency, is->live_dropped, is->live_rebuffers);
+	is->live_latency_sum = is->live_latency_max = 0;
+	is->live_latency_count = 0;
+	is->live_report_time = av_gettime();
+}
+
+void stream_print_stats(VideoState *is) {
+
+	int total = is->fast_path_frames + is->scaled_frames;
+	printf("Channel %d: %d pictures, %d plane-copied (%.1f%%), %d through sws_scale\n",
+			is->is_small ? 2 : 1, total, is->fast_path_frames,
+			total ? 100.0 * is->fast_path_frames / total : 0.0, is->scaled_frames);
+	printf("Channel %d memory: packets %d KB of %"PRId64" KB, pictures %"PRId64" KB, audio %"PRId64" KB, "
+			"next item and loop %"PRId64" KB\n",
+			is->is_small ? 2 : 1, (is->audioq.size + is->videoq.size) >> 10, channel_queue_limit(is) >> 10,
+			(is->mem_frames + is->mem_overlays) >> 10, is->mem_audio >> 10, is->mem_cache >> 10);
+	if(is->late_frames || is->video_underruns || is->audio_underruns)
+		printf("Channel %d: %d pictures late, %d video and %d audio underruns\n",
+				is->is_small ? 2 : 1, is->late_frames, is->video_underruns, is->audio_underruns);
+	if(is->intra_decoders)
+		printf("Channel %d: intra-only video on %d decoders\n", is->is_small ? 2 : 1, is->intra_decoders);
+	if(is->engine->cfg.live)
+		live_report(is);
+	if(is->engine->sync_lock && is->drift_count) {
+		printf("Channel %d drift from the master clock: now %+.1f ms, mean %+.1f ms, max %.1f ms\n",
+				is->is_small ? 2 : 1, is->drift * 1000, is->drift_sum / is->drift_count * 1000, is->drift_max * 1000);
+	}
+}
+
+/* statistics of both channels; allocations are also given since the
+   previous report so steady-state playback can be checked for zero
+   (but for the buffer references, which follow the picture count) */
+void print_stats(VideoState *is) {
+
+	AllocStats now = alloc_stats;
+
+	stream_print_stats(is);
+	stream_print_stats(is->is2);
+	printf("Allocations: %d frames (+%d), %d pooled buffers (+%d), %d default decoder buffers (+%d), "
+			"%d buffer references (+%d)\n",
+			now.frames, now.frames - is->engine->alloc_stats_last.frames,
+			now.buffers, now.buffers - is->engine->alloc_stats_last.buffers,
+			now.default_buffers, now.default_buffers - is->engine->alloc_stats_last.default_buffers,
+			now.refs, now.refs - is->engine->alloc_stats_last.refs);
+	is->engine->alloc_stats_last = now;
+	if(is->engine->screen)
+		printf("Renderer: %s, %dx%d\n", is->engine->renderer->name, is->engine->screen->w, is->engine->screen->h);
+}
+
+/* Live mode jitter buffer. A picture is due live_latency after the
+   arrival of the first one, shifted by its pts, so arrival jitter up to
+   the target is absorbed. A picture that comes after its slot (underrun)
+   or a timestamp jump puts the schedule back at the target. While
+   pictures wait longer than the target we are behind: the schedule
+   creeps forward, toRGB drops what has become late and the audio follows
+   the video clock slightly faster. Returns the seconds until vp is due. */
+static double live_schedule(VideoState *is, VideoPicture *vp) {
+
+	double now = av_gettime() / 1000000.0, arrival = vp->arrival / 1000000.0, target, latency;
+
+	target = vp->pts + is->live_offset;
+	if(!is->live_started || arrival > target || target - now > is->engine->nosync_threshold) {
+		if(is->live_started) {
+			is->live_rebuffers++;
+			if(arrival > target)
+				is->video_underruns++;	/* it came after its slot */
+		}
+		else
+			is->live_report_time = av_gettime();
+		is->live_offset = arrival + is->engine->cfg.latency - vp->pts;
+		is->live_started = 1;
+		target = vp->pts + is->live_offset;
+	}
+	if(target > now + 0.001)
+		return target - now;
+
+	if(target - arrival > is->engine->cfg.latency + LIVE_DROP_THRESHOLD)
+		is->live_offset -= FFMIN(target - arrival - is->engine->cfg.latency, LIVE_CATCHUP_STEP);
+	latency = now - arrival;
+	is->live_latency_sum += latency;
+	is->live_latency_max = FFMAX(is->live_latency_max, latency);
+	is->live_latency_count++;
+	if(av_gettime() - is->live_report_time > LIVE_REPORT_INTERVAL * 1000000LL)
+		live_report(is);
+	return 0;
+}
+
+/* live mode, color thread: is this picture too late to be shown? Dropping
+   it before the filters and the upload is how we catch up. */
+static int live_picture_late(VideoState *is, AVFrame *frame, double pts) {
+
+	if(!is->engine->cfg.live || !is->live_started || !frame->buf[0])
+		return 0;
+	if(av_gettime() / 1000000.0 - (pts + is->live_offset) < LIVE_DROP_THRESHOLD ||
+			is->live_drop_run >= LIVE_MAX_DROPS) {
+		is->live_drop_run = 0;
+		return 0;
+	}
+	is->live_drop_run++;
+	is->live_dropped++;
+	return 1;
+}
+
+/* display thread: done with the picture at the head of the queue */
+static void pictq_next(VideoState *is) {
+
+	if(++is->pictq_rindex == VIDEO_PICTURE_QUEUE_SIZE) {
+		is->pictq_rindex = 0;
+	}
+	SDL_LockMutex(is->pictq_mutex);
+	is->pictq_size--;
+	SDL_CondSignal(is->pictq_cond);
+	SDL_UnlockMutex(is->pictq_mutex);
+}
+
+/* lock mode: the other channel has its picture, the one waiting for it
+   goes on now instead of at the timeout */
+static void sync_barrier_wake(VideoState *is) {
+
+	if(!is->engine->virtual_clock && !SDL_RemoveTimer(is->refresh_timer))
+		return;	/* the timeout fired already, its refresh is on the way */
+	push_refresh(is);
+}
+
+/* Lock mode, display thread, after a seek: pictures from before it are
+   dropped, and neither channel shows one from after it until the other
+   has one too (or never does). The first to have one waits for the
+   other to wake it. Both then start on the master clock set to the
+   primary's picture. Returns 1 when 'vp' is not to be shown now. */
+static int sync_barrier(VideoState *is, VideoPicture *vp) {
+
+	PlayerEngine *e = is->engine;
+	VideoState *a = e->channels[0], *b = e->channels[1];
+	VideoState *other = e->channels[is == a];
+	int64_t now = engine_time(e);
+	int c, timeout;
+
+	if(!e->sync_barrier)
+		return 0;
+	/* whatever went wrong with the seeks, the barrier ends */
+	timeout = now - e->sync_barrier_time >= SYNC_BARRIER_TIMEOUT;
+	if(vp->serial < is->sync_serial && !timeout) {
+		pictq_next(is);
+		push_refresh(is);
+		return 1;
+	}
+	if(vp->serial >= is->sync_serial)
+		is->sync_held = 1;
+	if(!a->sync_held || !b->sync_held) {
+		if(!timeout) {
+			schedule_refresh(is, (SYNC_BARRIER_TIMEOUT - (now - e->sync_barrier_time)) / 1000 + 1);
+			return 1;
+		}
+		if(!a->sync_held && !b->sync_held)
+			fprintf(stderr, "No picture after the seek on either channel, not waiting for them\n");
+		else
+			fprintf(stderr, "Channel %d: no picture after the seek, not waiting for it\n", a->sync_held ? 2 : 1);
+	}
+	e->sync_barrier = 0;
+	e->clock_pts = a->sync_held ? a->pictq[a->pictq_rindex].pts : vp->pts;
+	e->clock_time = now;
+	if(other->sync_held)
+		sync_barrier_wake(other);
+	for(c = 0; c < 2; c++) {
+		e->channels[c]->sync_held = 0;
+		e->channels[c]->frame_timer = now / 1000000.0;
+	}
+	return 0;
+}
+
+/* virtual clock: a picture shown, and how far the sound heard is from it */
+static void virtual_log_picture(VideoState *is, VideoPicture *vp, double delay) {
+
+	double av = 0;
+
+	if(is == is->engine->audio_channel && is->audio_st && !is->audio_eof) {
+		av = get_audio_clock(is) - vp->pts;
+		is->av_sum += av;
+		is->av_max = FFMAX(is->av_max, fabs(av));
+		is->av_count++;
+	}
+	fprintf(is->engine->virtual_log, "%.6f %d video %.6f delay %.6f av %+.6f\n",
+			engine_time(is->engine) / 1000000.0, is->is_small ? 2 : 1, vp->pts, delay, av);
+}
+
+/* Shared statistics block of the engine (playerstat.h); a player
+   without one plays on, unmonitored. */
+static void stats_open(PlayerEngine *e) {
+
+	static int nb_engines;
+	int fd;
+
+	snprintf(e->stat_name, sizeof(e->stat_name), PLAYERSTAT_NAME, (int)getpid(), __sync_fetch_and_add(&nb_engines, 1));
+	fd = shm_open(e->stat_name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	if(fd < 0) {
+		fprintf(stderr, "%s: could not create the statistics block\n", e->stat_name);
+		return;
+	}
+	if(ftruncate(fd, sizeof(PlayerStatBlock)) < 0 ||
+			(e->stat_block = mmap(NULL, sizeof(PlayerStatBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		fprintf(stderr, "%s: could not map the statistics block\n", e->stat_name);
+		e->stat_block = NULL;
+		shm_unlink(e->stat_name);
+	}
+	close(fd);
+	if(!e->stat_block)
+		return;
+	e->stat_block->version = PLAYERSTAT_VERSION;
+	e->stat_block->size = sizeof(PlayerStatBlock);
+	e->stat_block->pid = getpid();
+	__sync_synchronize();
+	e->stat_block->magic = PLAYERSTAT_MAGIC;
+}
+
+static void stats_close(PlayerEngine *e) {
+
+	if(!e->stat_block)
+		return;
+	munmap(e->stat_block, sizeof(PlayerStatBlock));
+	shm_unlink(e->stat_name);
+	e->stat_block = NULL;
+}
+
+static Uint32 stats_timer_cb(Uint32 interval, void *opaque) {
+
+	SDL_Event event;
+
+	event.type = FF_STATS_EVENT;
+	event.user.data1 = opaque;
+	SDL_PushEvent(&event);
+	return interval;
+}
+
+/* the block is updated on its own timer, so stalls and underruns show
+   while no picture is; paused, it is updated once and the timer stops */
+static void stats_timer_start(PlayerEngine *e) {
+
+	if(e->stat_block && !e->stat_timer)
+		e->stat_timer = SDL_AddTimer(STAT_INTERVAL / 1000, stats_timer_cb, e->channels[0]);
+}
+
+static void stats_timer_stop(PlayerEngine *e) {
+
+	if(e->stat_timer)
+		SDL_RemoveTimer(e->stat_timer);
+	e->stat_timer = 0;
+}
+
+/* event thread: copy what the threads count into the shared block. The
+   counters are read as they are, the seqlock only makes the block as a
+   whole consistent for the readers. */
+static void stats_publish(PlayerEngine *e) {
+
+	PlayerStatBlock *b = e->stat_block;
+	PlayerStatChannel *sc;
+	VideoState *is;
+	int64_t now = av_gettime(), pictures;
+	int c;
+
+	playerstat_write_begin(b);
+	b->paused = e->paused;
+	b->sync_lock = e->sync_lock;
+	b->speed = e->speed;
+	for(c = 0; c < 2; c++) {
+		is = e->channels[c];
+		sc = &b->channels[c];
+		av_strlcpy(sc->filename, is->filename, sizeof(sc->filename));
+		sc->audioq_packets = is->audioq.nb_packets;
+		sc->videoq_packets = is->videoq.nb_packets;
+		sc->audioq_bytes = is->audioq.size;
+		sc->videoq_bytes = is->videoq.size;
+		sc->pictq_size = is->pictq_size;
+		sc->colorq_size = is->colorq_size;
+		pictures = is->video_pictures;
+		sc->fps = e->stat_time ? (pictures - e->stat_pictures[c]) * 1000000.0 / (now - e->stat_time) : 0;
+		sc->pictures = e->stat_pictures[c] = pictures;
+		sc->dropped = is->live_dropped;
+		sc->late = is->late_frames;
+		sc->audio_underruns = is->audio_underruns;
+		sc->video_underruns = is->video_underruns;
+		sc->clock = get_master_clock(is);
+		sc->av_diff = is->audio_st && is->video_st ? get_audio_clock(is) - get_video_clock(is) : 0;
+		sc->drift = e->sync_lock ? is->drift : 0;
+	}
+	b->update_time = now;
+	b->updates++;
+	playerstat_write_end(b);
+	e->stat_time = now;
+}
+
+void video_refresh_timer(void *userdata) {
+
+	VideoState *is = (VideoState *)userdata;
+	VideoPicture *vp;
+	double actual_delay, delay, sync_threshold, ref_clock, diff;
+	int empty;
+
+	if(is->engine->paused && !is->step) {
+		/* no timer while paused: player_toggle_pause restarts us */
+		is->refresh_stopped = 1;
+		return;
+	}
+	if(is->video_st) {
+		/* nothing to show: sleep until queue_picture wakes us up */
+		SDL_LockMutex(is->pictq_mutex);
+		empty = is->pictq_size == 0;
+		is->refresh_waiting = empty;
+		SDL_UnlockMutex(is->pictq_mutex);
+		/* a live channel looks again 1 ms after each picture, long
+		   before the next is due: its underruns are the pictures that
+		   arrive after their slot (live_schedule) */
+		if(empty && is->last_display_time && !is->engine->cfg.live)
+			is->video_underruns++;
+		if(!empty) {
+			vp = &is->pictq[is->pictq_rindex];
+			if(is->engine->virtual_clock && !vp->frame->buf[0]) {
+				/* the end of the channel: nothing more to schedule */
+				is->video_ended = 1;
+				pictq_next(is);
+				return;
+			}
+			if(is->engine->cfg.live && (actual_delay = live_schedule(is, vp)) > 0) {
+				/* still in the jitter buffer */
+				schedule_refresh(is, (int)(actual_delay * 1000 + 0.5));
+				return;
+			}
+			if(is->engine->sync_lock) {
+				if(sync_barrier(is, vp))
+					return;
+				if(!is->engine->clock_time) {
+					/* the master clock starts with the first picture */
+					is->engine->clock_pts = vp->pts;
+					is->engine->clock_time = engine_time(is->engine);
+				}
+			}
+
+			is->video_current_pts = vp->pts;
+			is->video_current_pts_time = engine_time(is->engine);
+
+			delay = vp->pts - is->frame_last_pts; /* the pts from last time */
+			if(delay <= 0 || delay >= 1.0) {
+				/* if incorrect delay, use previous one */
+				delay = is->frame_last_delay;
+			}
+			/* save for next time */
+			is->frame_last_delay = delay;
+			is->frame_last_pts = vp->pts;
+			if(is->keepup_resync) {
+				/* first picture out of keep-up mode: on time from now */
+				is->keepup_resync = 0;
+				is->frame_timer = engine_time(is->engine) / 1000000.0;
+			}
+
+			/* update delay to sync to audio if not master source */
+			if(is->av_sync_type != AV_SYNC_VIDEO_MASTER) {
+				ref_clock = get_master_clock(is);
+				diff = vp->pts - ref_clock;
+				if(is->engine->sync_lock) {
+					is->drift = diff;
+					is->drift_sum += diff;
+					is->drift_max = FFMAX(is->drift_max, fabs(diff));
+					is->drift_count++;
+				}
+
+				/* Skip or repeat the frame. Take delay into account
+	   			FFPlay still doesn't "know if this is the best guess." */
+				sync_threshold = (delay > AV_SYNC_THRESHOLD) ? delay : AV_SYNC_THRESHOLD;
+				if(fabs(diff) < is->engine->nosync_threshold) {
+					if(diff <= -sync_threshold) {
+						delay = 0;
+					}
+					else if(diff >= sync_threshold) {
+						delay = 2 * delay;
+					}
+				}
+			}
+			/* seconds of media to seconds on the clock */
+			delay /= is->engine->speed;
+			if(is->engine->paused) {
+				/* a step: as if the picture had been shown when we paused,
+				   so resuming waits one frame for the next */
+				is->frame_timer = is->engine->pause_time / 1000000.0 + delay;
+				is->step = 0;
+				is->refresh_stopped = 1;
+				if(is->engine->sync_lock && is == is->engine->channels[0]) {
+					/* the master clock steps with the primary */
+					is->engine->clock_pts = vp->pts;
+					is->engine->clock_time = is->engine->pause_time;
+				}
+			}
+			else {
+				is->frame_timer += delay;
+				/* computer the REAL delay */
+				actual_delay = is->frame_timer - (engine_time(is->engine) / 1000000.0);
+				if(actual_delay < 0)
+					is->late_frames++;
+				if(is->engine->virtual_log)
+					virtual_log_picture(is, vp, actual_delay);
+				if(actual_delay < 0.010) {
+					/* Really it should skip the picture instead */
+					actual_delay = 0.010;
+				}
+				/* a live picture has its own slot; look for the next one soon */
+				schedule_refresh(is, is->engine->cfg.live ? 1 : (int)(actual_delay * 1000 + 0.5));
+			}
+
+			/* show the picture! */
+			if(vp->frame->buf[0]) {
+				av_frame_unref(is->shown_frame);
+				av_frame_move_ref(is->shown_frame, vp->frame);
+				is->shown_serial++;
+			}
+			if(is->engine->screen)
+				video_display(is);
+			if(is->engine->comparator)
+				compare_update(is->engine);
+			if(is->engine->recorder)
+				recorder_capture(is->engine->recorder);
+			if(vp->item_start && is->last_display_time) {
+				fprintf(stderr, "Channel %d: playlist transition took %.1f ms between frames (nominal %.1f ms)\n",
+						is->is_small ? 2 : 1, (av_gettime() - is->last_display_time) / 1000.0, delay * 1000.0);
+			}
+			/* with a window, the renderer says when it is on the screen */
+			if(!is->engine->screen)
+				startup_shown(is);
+			is->last_display_time = av_gettime();
+
+			/* update queue for next picture! */
+			pictq_next(is);
+		}
+	}
+	else schedule_refresh(is, 100);
+}
+
+void alloc_picture(void *userdata) {
+
+	VideoState *is = (VideoState *)userdata;
+	VideoPicture *vp;
+
+	vp = &is->pictq[is->pictq_windex];
+	if(vp->bmp) {
+		// we already have one make another, bigger/smaller
+		overlay_free(is, vp->bmp);
+	}
+	// Allocate a place to put our YUV image on that is->engine->screen (size requested by queue_picture)
+	vp->bmp = SDL_CreateYUVOverlay(vp->width,vp->height,SDL_YV12_OVERLAY,is->engine->screen);
+	if(vp->bmp)
+		mem_charge(&is->mem_overlays, (int64_t)vp->bmp->w * vp->bmp->h * 3 / 2);
+
+	SDL_LockMutex(is->pictq_mutex);
+	vp->allocated = 1;
+	SDL_CondSignal(is->pictq_cond);
+	SDL_UnlockMutex(is->pictq_mutex);
+}
+
+/* Overlay renderer: every queued picture has an overlay of its own size,
+   filled here and shown by itself in the tile of its channel. */
+static int overlay_upload(VideoState *is, VideoPicture *vp, AVFrame *pFrame) {
+
+	AVPicture pict;
+
+	/* allocate or resize the buffer! */
+	if(!vp->bmp || vp->width != pFrame->width || vp->height != pFrame->height) {
+		SDL_Event event;
+
+		vp->allocated = 0;
+		vp->width = pFrame->width;
+		vp->height = pFrame->height;
+		/* we have to do it in the main thread */
+		event.type = FF_ALLOC_EVENT;
+		event.user.data1 = is;
+		SDL_PushEvent(&event);
+
+		/* wait until we have a picture allocated */
+		SDL_LockMutex(is->pictq_mutex);
+		while(!vp->allocated && !is->quit) {
+			SDL_CondWait(is->pictq_cond, is->pictq_mutex);
+		}
+		SDL_UnlockMutex(is->pictq_mutex);
+		if(is->quit) {
+			return -1;
+		}
+	}
+	if(!vp->bmp)
+		return 1;
+	SDL_LockYUVOverlay(vp->bmp);
+
+	//dst_pix_fmt = PIX_FMT_YUV420P;
+	/* point pict at the queue */
+
+	pict.data[0] = vp->bmp->pixels[0];
+	pict.data[1] = vp->bmp->pixels[2];
+	pict.data[2] = vp->bmp->pixels[1];
+
+	pict.linesize[0] = vp->bmp->pitches[0];
+	pict.linesize[1] = vp->bmp->pitches[2];
+	pict.linesize[2] = vp->bmp->pitches[1];
+	if(pFrame->format == AV_PIX_FMT_YUV420P && pFrame->width == vp->width && pFrame->height == vp->height) {
+		/* fast path: the decoder already gives us the overlay's layout,
+		   a plane copy is all it takes */
+		av_image_copy_plane(pict.data[0], pict.linesize[0], pFrame->data[0], pFrame->linesize[0],
+				vp->width, vp->height);
+		av_image_copy_plane(pict.data[1], pict.linesize[1], pFrame->data[1], pFrame->linesize[1],
+				(vp->width + 1) / 2, (vp->height + 1) / 2);
+		av_image_copy_plane(pict.data[2], pict.linesize[2], pFrame->data[2], pFrame->linesize[2],
+				(vp->width + 1) / 2, (vp->height + 1) / 2);
+		is->fast_path_frames++;
+	}
+	else {
+		// playlist items may differ in size and format
+		is->sws_ctx = sws_getCachedContext(is->sws_ctx, pFrame->width, pFrame->height, pFrame->format,
+				vp->width, vp->height, AV_PIX_FMT_YUV420P, SWS_BILINEAR, NULL, NULL, NULL);
+		// Convert the image into YUV format that SDL uses
+		sws_scale
+		(
+				is->sws_ctx,
+				(uint8_t const * const *)pFrame->data,
+				pFrame->linesize,
+				0,
+				pFrame->height,
+				pict.data,
+				pict.linesize
+		);
+		is->scaled_frames++;
+	}
+	/* black and white is now handled with rgb (toRGB function)
+	if(is->color_flag == 1) {
+        		memset(vp->bmp->pixels[1], 128, vp->height*vp->width/2);
+        		memset(vp->bmp->pixels[2], 128, vp->height*vp->width/2);
+    		}
+	 */
+	if(is->color_flag == 5) {
+		memset(vp->bmp->pixels[2], 100, vp->height*vp->width/2);
+
+	}
+	SDL_UnlockYUVOverlay(vp->bmp);
+	/* the recorder composites from the pictures, not the overlays */
+	av_frame_unref(vp->frame);
+	if(is->engine->recorder && pFrame->buf[0])
+		frame_ref(vp->frame, pFrame);
+	return 0;
+}
+
+static void overlay_present(VideoState *is, VideoPicture *vp) {
+
+	SDL_Rect rect;
+
+	if(vp->bmp && video_tile_rect(is, is->engine->screen->w, is->engine->screen->h, &rect)) {
+		SDL_DisplayYUVOverlay(vp->bmp, &rect);
+		startup_shown(is);
+	}
+}
+
+/* Canvas renderer: a queued picture is only a reference to the decoded
+   (or filtered) frame. On display the tiles are scaled straight into one
+   overlay the size of the screen, which is presented once for all of
+   them; a tile whose picture did not change is not drawn again. Works
+   with any SDL video driver, the software and dummy ones included. */
+static int canvas_open(PlayerEngine *e) {
+
+	SDL_Overlay *o;
+
+	o = e->canvas = SDL_CreateYUVOverlay(e->screen->w & ~1, e->screen->h & ~1, SDL_YV12_OVERLAY, e->screen);
+	if(!o) {
+		fprintf(stderr, "SDL: could not create the canvas overlay - %s\n", SDL_GetError());
+		return -1;
+	}
+	SDL_LockYUVOverlay(o);
+	memset(o->pixels[0], 16, o->pitches[0] * o->h);
+	memset(o->pixels[1], 128, o->pitches[1] * o->h / 2);
+	memset(o->pixels[2], 128, o->pitches[2] * o->h / 2);
+	SDL_UnlockYUVOverlay(o);
+	if(!(e->view_frame = frame_alloc()))
+		return -1;
+	return 0;
+}
+
+static void canvas_close(PlayerEngine *e) {
+
+	int c;
+
+	if(e->canvas)
+		SDL_FreeYUVOverlay(e->canvas);
+	e->canvas = NULL;
+	av_frame_free(&e->view_frame);
+	frame_pool_uninit(&e->view_pool);
+	sws_freeContext(e->view_sws);
+	e->view_sws = NULL;
+	for(c = 0; c < 2; c++) {
+		sws_freeContext(e->canvas_sws[c]);
+		e->canvas_sws[c] = NULL;
+	}
+}
+
+static int canvas_upload(VideoState *is, VideoPicture *vp, AVFrame *frame) {
+
+	av_frame_unref(vp->frame);
+	if(frame_ref(vp->frame, frame) < 0)
+		return 1;
+	vp->width = frame->width;
+	vp->height = frame->height;
+	return 0;
+}
+
+/* difference view: |dst - src| amplified 4 times; luma differences light
+   the picture up, chroma ones tint it (U blue, V red) */
+static void view_diff_line(uint8_t *dst, const uint8_t *src, int width, int plane) {
+
+	int x = 0, d;
+#ifdef __SSE2__
+	__m128i mid = _mm_set1_epi8(-128), half = _mm_set1_epi8(0x7f), a, b, v;
+
+	for(; x + 16 <= width; x += 16) {
+		a = _mm_loadu_si128((const __m128i *)(dst + x));
+		b = _mm_loadu_si128((const __m128i *)(src + x));
+		v = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+		v = _mm_adds_epu8(v, v);
+		v = _mm_adds_epu8(v, v);
+		if(plane)
+			v = _mm_adds_epu8(mid, _mm_and_si128(_mm_srli_epi16(v, 1), half));
+		_mm_storeu_si128((__m128i *)(dst + x), v);
+	}
+#endif
+	for(; x < width; x++) {
+		d = FFMIN(abs(dst[x] - src[x]) * 4, 255);
+		dst[x] = plane ? 128 + d / 2 : d;
+	}
+}
+
+/* Build one plane of a comparison view in place: 'dst' holds the primary
+   picture, 'src' the second one at the same size. 'split' is the column
+   of the wipe divider, 'cell' the checkerboard cell size. */
+static void view_plane(int view, int plane, uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+		int width, int height, int split, int cell) {
+
+	int x, y;
+
+	for(y = 0; y < height; y++, dst += dst_stride, src += src_stride) {
+		switch(view) {
+		case PLAYER_VIEW_DIFF:
+			view_diff_line(dst, src, width, plane);
+			break;
+		case PLAYER_VIEW_WIPE:
+			memcpy(dst + split, src + split, width - split);
+			if(split > 0 && split < width)
+				dst[split] = plane ? 128 : 235;
+			break;
+		case PLAYER_VIEW_CHECKER:
+			for(x = (y / cell) & 1 ? 0 : cell; x < width; x += 2 * cell)
+				memcpy(dst + x, src + x, FFMIN(cell, width - x));
+			break;
+		}
+	}
+}
+
+/* Compose the comparison view of what 'a' and 'b' show into the YUV420P
+   planes 'data' (width x height), at 'rect'. Returns < 0 when nothing
+   could be drawn. */
+static int view_draw(PlayerEngine *e, VideoState *a, VideoState *b, const SDL_Rect *rect,
+		uint8_t *const data[3], const int linesize[3], int width, int height) {
+
+	AVFrame *view = e->view_frame;
+	SDL_Rect tile = { 0, 0, rect->w, rect->h };
+	int p, ret, split, cell, shift;
+
+	view->format = AV_PIX_FMT_YUV420P;
+	view->width = rect->w;
+	view->height = rect->h;
+	if(frame_pool_get(&e->view_pool, view, rect->w, rect->h) < 0)
+		return -1;
+	ret = tile_draw(&e->view_sws, b->shown_frame, &tile, b->color_flag, view->data, view->linesize, rect->w, rect->h);
+	if(ret > 0)
+		b->fast_path_frames++;
+	else if(!ret)
+		b->scaled_frames++;
+	ret = ret < 0 ? ret : tile_draw(&e->canvas_sws[0], a->shown_frame, rect, a->color_flag, data, linesize, width, height);
+	if(ret > 0)
+		a->fast_path_frames++;
+	else if(!ret)
+		a->scaled_frames++;
+	if(ret >= 0) {
+		for(p = 0; p < 3; p++) {
+			shift = p ? 1 : 0;
+			split = (int)(e->wipe_pos * rect->w) >> shift;
+			cell = VIEW_CHECKER_SIZE >> shift;
+			view_plane(e->view, p, data[p] + (rect->y >> shift) * linesize[p] + (rect->x >> shift), linesize[p],
+					view->data[p], view->linesize[p], rect->w >> shift, rect->h >> shift, split, cell);
+		}
+	}
+	av_frame_unref(view);
+	return ret;
+}
+
+/* Comparison views: both pictures in the primary's place, full screen,
+   combined into the canvas in one pass over each plane. They are only
+   composed from pictures of the same pts, so the difference of two
+   pictures shown a refresh apart never flashes up; a pair that does not
+   come within VIEW_STALE is composed anyway (streams offset in time). */
+static void canvas_present_view(PlayerEngine *e) {
+
+	VideoState *a = e->channels[0], *b = e->channels[1];
+	SDL_Overlay *o = e->canvas;
+	SDL_Rect full = { 0, 0, e->screen->w, e->screen->h }, rect;
+	uint8_t *data[3];
+	int linesize[3];
+	int relayout, ret;
+	double tolerance;
+	int64_t now = av_gettime();
+
+	if(!a->video_st || !a->shown_frame->buf[0] || !b->shown_frame->buf[0])
+		return;
+	video_fit_rect(a, o->w, o->h, &rect);
+	rect.x &= ~1;
+	rect.y &= ~1;
+	rect.w = FFMIN(rect.w, o->w - rect.x) & ~1;
+	rect.h = FFMIN(rect.h, o->h - rect.y) & ~1;
+	if(rect.w <= 0 || rect.h <= 0)
+		return;
+	relayout = memcmp(&rect, &e->canvas_rects[0], sizeof(rect)) || e->canvas_rects[1].w;
+	if(!relayout && !e->view_dirty) {
+		if(a->shown_serial == e->canvas_serials[0] && b->shown_serial == e->canvas_serials[1])
+			return;
+		tolerance = COMPARE_PTS_TOLERANCE * FFMIN(a->frame_last_delay, b->frame_last_delay);
+		if(fabs(a->video_current_pts - b->video_current_pts) > FFMAX(tolerance, 0.001) &&
+				now - e->view_time < VIEW_STALE)
+			return;
+	}
+	e->canvas_serials[0] = a->shown_serial;
+	e->canvas_serials[1] = b->shown_serial;
+	e->view_dirty = 0;
+	e->view_time = now;
+
+	SDL_LockYUVOverlay(o);
+	if(relayout) {
+		memset(o->pixels[0], 16, o->pitches[0] * o->h);
+		memset(o->pixels[1], 128, o->pitches[1] * o->h / 2);
+		memset(o->pixels[2], 128, o->pitches[2] * o->h / 2);
+		e->canvas_rects[0] = rect;
+		memset(&e->canvas_rects[1], 0, sizeof(SDL_Rect));
+	}
+	data[0] = o->pixels[0];
+	data[1] = o->pixels[2];
+	data[2] = o->pixels[1];
+	linesize[0] = o->pitches[0];
+	linesize[1] = o->pitches[2];
+	linesize[2] = o->pitches[1];
+	ret = view_draw(e, a, b, &rect, data, linesize, o->w, o->h);
+	SDL_UnlockYUVOverlay(o);
+	SDL_DisplayYUVOverlay(o, &full);
+	if(ret >= 0) {
+		startup_shown(a);
+		startup_shown(b);
+	}
+}
+
+/* event thread, once per refresh tick: both tiles (or the view) into the
+   canvas and the canvas on the screen */
+static void canvas_compose(PlayerEngine *e) {
+
+	SDL_Overlay *o = e->canvas;
+	VideoState *is;
+	SDL_Rect full = { 0, 0, e->screen->w, e->screen->h };
+	Composition layout;
+	uint8_t *data[3];
+	int linesize[3];
+	int c, ret, relayout = 0;
+
+	if(e->view != PLAYER_VIEW_STACKED) {
+		canvas_present_view(e);
+		return;
+	}
+	/* back from a comparison view: every tile again */
+	relayout = e->view_dirty;
+	e->view_dirty = 0;
+	composition_layout(&layout, e->channels, o->w, o->h);
+	for(c = 0; c < 2; c++) {
+		if(memcmp(&layout.rects[c], &e->canvas_rects[c], sizeof(SDL_Rect)))
+			relayout = 1;
+	}
+	SDL_LockYUVOverlay(o);
+	if(relayout) {
+		// the tiles moved: start over from a black screen
+		memset(o->pixels[0], 16, o->pitches[0] * o->h);
+		memset(o->pixels[1], 128, o->pitches[1] * o->h / 2);
+		memset(o->pixels[2], 128, o->pitches[2] * o->h / 2);
+		memcpy(e->canvas_rects, layout.rects, sizeof(e->canvas_rects));
+	}
+	// YV12 has V before U
+	data[0] = o->pixels[0];
+	data[1] = o->pixels[2];
+	data[2] = o->pixels[1];
+	linesize[0] = o->pitches[0];
+	linesize[1] = o->pitches[2];
+	linesize[2] = o->pitches[1];
+	for(c = 0; c < 2; c++) {
+		is = e->channels[c];
+		if(!is->shown_frame->buf[0] || (!relayout && e->canvas_serials[c] == is->shown_serial))
+			continue;
+		e->canvas_serials[c] = is->shown_serial;
+		ret = tile_draw(&e->canvas_sws[c], is->shown_frame, &layout.rects[c], layout.color_flags[c],
+				data, linesize, o->w, o->h);
+		if(ret > 0)
+			is->fast_path_frames++;
+		else if(!ret)
+			is->scaled_frames++;
+	}
+	SDL_UnlockYUVOverlay(o);
+	SDL_DisplayYUVOverlay(o, &full);
+	for(c = 0; c < 2; c++) {
+		if(e->channels[c]->shown_frame->buf[0])
+			startup_shown(e->channels[c]);
+	}
+}
+
+/* ask for a compose after the refreshes already queued: the channels
+   refreshed in the same tick share one present */
+static void canvas_request(PlayerEngine *e) {
+
+	SDL_Event event;
+
+	if(!e->canvas || e->present_pending)
+		return;
+	e->present_pending = 1;
+	event.type = FF_PRESENT_EVENT;
+	event.user.data1 = e->channels[0];
+	SDL_PushEvent(&event);
+}
+
+static void canvas_present(VideoState *is, VideoPicture *vp) {
+
+	canvas_request(is->engine);
+}
+
+static const Renderer renderers[] = {
+	[PLAYER_RENDERER_CANVAS] = { "canvas", canvas_open, canvas_close, canvas_upload, canvas_present },
+	[PLAYER_RENDERER_OVERLAY] = { "overlay", NULL, NULL, overlay_upload, overlay_present },
+};
+
+int queue_picture(VideoState *is, AVFrame *pFrame, double pts) {
+
+	VideoPicture *vp;
+	int ret;
+
+	/* wait until we have space for a new pic */
+	SDL_LockMutex(is->pictq_mutex);
+	while(is->pictq_size >= VIDEO_PICTURE_QUEUE_SIZE && !is->quit) {
+		SDL_CondWait(is->pictq_cond, is->pictq_mutex);
+	}
+	SDL_UnlockMutex(is->pictq_mutex);
+
+	if(is->quit) return -1;
+
+	// windex is set to 0 initially
+	vp = &is->pictq[is->pictq_windex];
+
+	if(!is->engine->screen) {
+		/* no window: the exporter takes a reference to the picture and
+		   composites it itself, the virtual clock only times it; an
+		   empty picture marks the end */
+		if(pFrame->buf[0] && frame_ref(vp->frame, pFrame) < 0)
+			return -1;
+		vp->pts = pts;
+		vp->item_start = is->curr_item_start;
+		vp->serial = is->curr_serial;
+		if(++is->pictq_windex == VIDEO_PICTURE_QUEUE_SIZE) {
+			is->pictq_windex = 0;
+		}
+		SDL_LockMutex(is->pictq_mutex);
+		is->pictq_size++;
+		SDL_CondSignal(is->pictq_cond);
+		if(is->refresh_waiting) {
+			is->refresh_waiting = 0;
+			push_refresh(is);
+		}
+		SDL_UnlockMutex(is->pictq_mutex);
+		return 0;
+	}
+
+	ret = is->engine->renderer->upload(is, vp, pFrame);
+	if(ret)
+		return ret < 0 ? -1 : 0;
+	vp->pts = pts;
+	vp->arrival = pFrame->reordered_opaque > 0 ? pFrame->reordered_opaque : av_gettime();
+	vp->item_start = is->curr_item_start;
+	vp->serial = is->curr_serial;
+
+	/* now we inform our display thread that we have a pic ready */
+	if(++is->pictq_windex == VIDEO_PICTURE_QUEUE_SIZE) {
+		is->pictq_windex = 0;
+	}
+	SDL_LockMutex(is->pictq_mutex);
+	is->pictq_size++;
+	if(is->refresh_waiting) {
+		is->refresh_waiting = 0;
+		push_refresh(is);
+	}
+	SDL_UnlockMutex(is->pictq_mutex);
+	return 0;
+}
+
+double synchronize_video(VideoState *is, AVFrame *src_frame, double pts) {
+
+	double frame_delay;
+
+	if(pts != 0) {
+		/* if we have pts, set video clock to it */
+		is->video_clock = pts;
+	}
+	else {
+		/* if we aren't given a pts, set it to the clock */
+		pts = is->video_clock;
+	}
+	/* update the video clock */
+	frame_delay = av_q2d(is->video_st->codec->time_base);
+	/* if we are repeating a frame, adjust clock accordingly */
+	frame_delay += src_frame->repeat_pict * (frame_delay * 0.5);
+	is->video_clock += frame_delay;
+	return pts;
+}
+
+/* The video decoder draws its pictures from the FramePool of the playlist
+   item (codec opaque) so they are recycled instead of reallocated. */
+int our_get_buffer(struct AVCodecContext *c, AVFrame *pic, int flags) {
+
+	int w = pic->width, h = pic->height;
+	int linesize_align[AV_NUM_DATA_POINTERS];
+
+	if(c->opaque && (c->codec->capabilities & CODEC_CAP_DR1)) {
+		avcodec_align_dimensions2(c, &w, &h, linesize_align);
+		if(!frame_pool_get(c->opaque, pic, w, h))
+			return 0;
+	}
+	__sync_fetch_and_add(&alloc_stats.default_buffers, 1);
+	return avcodec_default_get_buffer2(c, pic, flags);
+}
+
+/* take the next slice of 'job' off the list of jobs to hand out (locked) */
+static int worker_pool_next_slice(WorkerPool *wp, SliceJob *job) {
+
+	SliceJob **p;
+	int slice = job->next_slice++;
+
+	if(job->next_slice == job->nb_slices) {
+		for(p = &wp->jobs; *p != job; p = &(*p)->next);
+		*p = job->next;
+	}
+	return slice;
+}
+
+static void *worker_thread(void *arg) {
+
+	WorkerPool *wp = arg;
+	SliceJob *job;
+	int slice;
+
+	pthread_mutex_lock(&wp->mutex);
+	for(;;) {
+		while(!wp->quit && !wp->jobs) {
+			pthread_cond_wait(&wp->work_cond, &wp->mutex);
+		}
+		if(wp->quit) break;
+		job = wp->jobs;
+		slice = worker_pool_next_slice(wp, job);
+		pthread_mutex_unlock(&wp->mutex);
+		job->fn(job->arg, slice, job->nb_slices);
+		pthread_mutex_lock(&wp->mutex);
+		if(++job->done_slices == job->nb_slices)
+			pthread_cond_broadcast(&wp->done_cond);
+	}
+	pthread_mutex_unlock(&wp->mutex);
+	return NULL;
+}
+
+WorkerPool *worker_pool_create(int nb_threads) {
+
+	WorkerPool *wp = av_mallocz(sizeof(WorkerPool));
+	int i;
+
+	if(!wp) return NULL;
+	pthread_mutex_init(&wp->mutex, NULL);
+	pthread_cond_init(&wp->work_cond, NULL);
+	pthread_cond_init(&wp->done_cond, NULL);
+	wp->threads = av_mallocz(FFMAX(nb_threads, 1) * sizeof(pthread_t));
+	for(i = 0; i < nb_threads && wp->threads; i++) {
+		if(pthread_create(&wp->threads[i], NULL, worker_thread, wp))
+			break;
+	}
+	wp->nb_threads = i;
+	return wp;
+}
+
+void worker_pool_free(WorkerPool *wp) {
+
+	int i;
+
+	if(!wp) return;
+	pthread_mutex_lock(&wp->mutex);
+	wp->quit = 1;
+	pthread_cond_broadcast(&wp->work_cond);
+	pthread_mutex_unlock(&wp->mutex);
+	for(i = 0; i < wp->nb_threads; i++)
+		pthread_join(wp->threads[i], NULL);
+	pthread_mutex_destroy(&wp->mutex);
+	pthread_cond_destroy(&wp->work_cond);
+	pthread_cond_destroy(&wp->done_cond);
+	av_free(wp->threads);
+	av_free(wp);
+}
+
+/* run fn(arg, slice, nb_slices) for every slice and wait until all are done */
+void worker_pool_run(WorkerPool *wp, slice_func fn, void *arg, int nb_slices) {
+
+	SliceJob job = { fn, arg, nb_slices, 0, 0, NULL };
+	SliceJob **p;
+	int slice;
+
+	if(!wp || !wp->nb_threads || nb_slices == 1) {
+		for(slice = 0; slice < nb_slices; slice++)
+			fn(arg, slice, nb_slices);
+		return;
+	}
+	pthread_mutex_lock(&wp->mutex);
+	for(p = &wp->jobs; *p; p = &(*p)->next);
+	*p = &job;
+	pthread_cond_broadcast(&wp->work_cond);
+	while(job.next_slice < job.nb_slices) {
+		slice = worker_pool_next_slice(wp, &job);
+		pthread_mutex_unlock(&wp->mutex);
+		fn(arg, slice, nb_slices);
+		pthread_mutex_lock(&wp->mutex);
+		job.done_slices++;
+	}
+	while(job.done_slices < job.nb_slices) {
+		pthread_cond_wait(&wp->done_cond, &wp->mutex);
+	}
+	pthread_mutex_unlock(&wp->mutex);
+}
+
+void color_filter_uninit(ColorFilter *cf) {
+
+	int i;
+
+	for(i = 0; i < MAX_SLICES; i++) {
+		sws_freeContext(cf->to_rgb[i]);
+		sws_freeContext(cf->from_rgb[i]);
+		cf->to_rgb[i] = cf->from_rgb[i] = NULL;
+	}
+	av_frame_free(&cf->rgb);
+	av_freep(&cf->rgb_buffer);
+	cf->width = cf->height = 0;
+}
+
+/* (re)build the slices, scalers and RGB picture for a source of this size
+   and format; every slice but the last is a whole number of chroma rows
+   (and of row pairs), the last one takes what is left */
+static int color_filter_setup(ColorFilter *cf, int width, int height, int format) {
+
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(format);
+	int i, h, align, units, nb_slices, linesize;
+
+	if(cf->width == width && cf->height == height && cf->format == format)
+		return 0;
+	color_filter_uninit(cf);
+	if(!desc) return -1;
+
+	align = FFMAX(2, 1 << desc->log2_chroma_h);
+	units = height / align;	/* whole chroma rows in the picture */
+	nb_slices = worker_pool ? worker_pool->nb_threads + 1 : 1;
+	nb_slices = av_clip(nb_slices, 1, FFMAX(1, FFMIN(MAX_SLICES, height / MIN_SLICE_HEIGHT)));
+	nb_slices = FFMIN(nb_slices, FFMAX(1, units));
+	for(i = 0; i < nb_slices; i++)
+		cf->slice_y[i] = (int)((int64_t)units * i / nb_slices) * align;
+	cf->slice_y[nb_slices] = height;
+
+	for(i = 0; i < nb_slices; i++) {
+		h = cf->slice_y[i + 1] - cf->slice_y[i];
+		cf->to_rgb[i] = sws_getContext(width, h, format, width, h, PIX_FMT_RGB24, SWS_BILINEAR, NULL, NULL, NULL);
+		cf->from_rgb[i] = sws_getContext(width, h, PIX_FMT_RGB24, width, h, format, SWS_BILINEAR, NULL, NULL, NULL);
+		if(!cf->to_rgb[i] || !cf->from_rgb[i]) {
+			color_filter_uninit(cf);
+			return -1;
+		}
+	}
+
+	linesize = FFALIGN(width * 3, FRAME_POOL_ALIGN);
+	cf->rgb = frame_alloc();
+	cf->rgb_buffer = av_malloc(linesize * height + 16);
+	if(!cf->rgb || !cf->rgb_buffer) {
+		color_filter_uninit(cf);
+		return -1;
+	}
+	cf->rgb->data[0] = cf->rgb_buffer;
+	cf->rgb->linesize[0] = linesize;
+	cf->rgb->width = width;
+	cf->rgb->height = height;
+	cf->rgb->format = PIX_FMT_RGB24;
+
+	cf->nb_slices = nb_slices;
+	cf->width = width;
+	cf->height = height;
+	cf->format = format;
+	return 0;
+}
+
+void lut3d_free(Lut3D **lut) {
+
+	if(!*lut) return;
+	av_freep(&(*lut)->table);
+	av_freep(&(*lut)->table_yuv);
+	av_freep(lut);
+}
+
+/* Load a 3D LUT in the .cube format (LUT_3D_SIZE, DOMAIN_MIN/MAX and one
+   "r g b" line per grid point, red changing fastest). */
+Lut3D *lut3d_load(const char *filename) {
+
+	FILE *file;
+	Lut3D *lut;
+	char line[512], *p;
+	float dmin[3] = { 0, 0, 0 }, dmax[3] = { 1, 1, 1 }, r, g, b, x;
+	v4f rgb;
+	int size = 0, total = 0, n = 0, c, v, i, stride[3];
+
+	file = fopen(filename, "r");
+	if(!file) {
+		fprintf(stderr, "Could not open LUT %s\n", filename);
+		return NULL;
+	}
+	lut = av_mallocz(sizeof(Lut3D));
+	if(!lut) goto fail;
+
+	while(fgets(line, sizeof(line), file)) {
+		p = line + strspn(line, " \t");
+		if(*p == '#' || *p == '\r' || *p == '\n' || !*p)
+			continue;
+		if(!strncmp(p, "LUT_3D_SIZE", 11)) {
+			size = strtol(p + 11, NULL, 10);
+			if(lut->table || size < 2 || size > MAX_LUT_SIZE) {
+				fprintf(stderr, "%s: unsupported LUT_3D_SIZE %d\n", filename, size);
+				goto fail;
+			}
+			total = size * size * size;
+			lut->table = av_malloc(total * sizeof(v4f));
+			lut->table_yuv = av_malloc(total * sizeof(v4f));
+			if(!lut->table || !lut->table_yuv) goto fail;
+			lut->size = size;
+		}
+		else if(!strncmp(p, "DOMAIN_MIN", 10)) {
+			if(sscanf(p + 10, "%f %f %f", &dmin[0], &dmin[1], &dmin[2]) != 3) goto bad_line;
+		}
+		else if(!strncmp(p, "DOMAIN_MAX", 10)) {
+			if(sscanf(p + 10, "%f %f %f", &dmax[0], &dmax[1], &dmax[2]) != 3) goto bad_line;
+		}
+		else if(!strncmp(p, "LUT_1D_SIZE", 11)) {
+			fprintf(stderr, "%s: 1D LUTs are not supported\n", filename);
+			goto fail;
+		}
+		else if(sscanf(p, "%f %f %f", &r, &g, &b) == 3) {
+			if(!lut->table || n >= total) goto bad_line;
+			// outputs are clamped once here; interpolation never leaves the range
+			rgb = (v4f){ av_clipf(r, 0, 1) * 255, av_clipf(g, 0, 1) * 255, av_clipf(b, 0, 1) * 255, 0 };
+			lut->table[n] = rgb;
+			lut->table_yuv[n++] = (v4f){
+				( 66 * rgb[0] + 129 * rgb[1] +  25 * rgb[2]) / 256 +  16.5f,
+				(-38 * rgb[0] -  74 * rgb[1] + 112 * rgb[2]) / 256 + 128.5f,
+				(112 * rgb[0] -  94 * rgb[1] -  18 * rgb[2]) / 256 + 128.5f, 0 };
+		}
+		else if((*p < 'A' || *p > 'Z'))	// other keywords (TITLE, ...) are ignored
+			goto bad_line;
+	}
+	if(!lut->table || n != total) {
+		fprintf(stderr, "%s: expected %d LUT entries, found %d\n", filename, total, n);
+		goto fail;
+	}
+
+	stride[0] = 1;
+	stride[1] = size;
+	stride[2] = size * size;
+	for(c = 0; c < 3; c++) {
+		if(dmax[c] <= dmin[c]) {
+			fprintf(stderr, "%s: empty domain\n", filename);
+			goto fail;
+		}
+		for(v = 0; v < 256; v++) {
+			x = (v / 255.0f - dmin[c]) / (dmax[c] - dmin[c]) * (size - 1);
+			x = av_clipf(x, 0, size - 1);
+			i = FFMIN((int)x, size - 2);
+			lut->index[c][v] = i * stride[c];
+			lut->frac[c][v] = x - i;
+		}
+	}
+	fclose(file);
+	printf("Loaded %dx%dx%d LUT %s\n", size, size, size, filename);
+	return lut;
+
+bad_line:
+	fprintf(stderr, "%s: invalid line: %s", filename, line);
+fail:
+	fclose(file);
+	lut3d_free(&lut);
+	return NULL;
+}
+
+/* Tetrahedral interpolation: the cell is split in six tetrahedra along its
+   main diagonal; sorting the fractions picks the one holding the point,
+   whose four corners are blended with vector multiply-adds. */
+static inline v4f lut3d_lookup(const Lut3D *lut, const v4f *table, int r, int g, int b) {
+
+	const v4f *c000 = table + lut->index[0][r] + lut->index[1][g] + lut->index[2][b];
+	const int sg = lut->size, sb = sg * sg;
+	float fr = lut->frac[0][r], fg = lut->frac[1][g], fb = lut->frac[2][b];
+	float t1, t2, t3;
+	int o1, o2;
+
+	if(fr > fg) {
+		if(fg > fb) {
+			o1 = 1; o2 = 1 + sg; t1 = fr; t2 = fg; t3 = fb;
+		}
+		else if(fr > fb) {
+			o1 = 1; o2 = 1 + sb; t1 = fr; t2 = fb; t3 = fg;
+		}
+		else {
+			o1 = sb; o2 = 1 + sb; t1 = fb; t2 = fr; t3 = fg;
+		}
+	}
+	else {
+		if(fb > fg) {
+			o1 = sb; o2 = sg + sb; t1 = fb; t2 = fg; t3 = fr;
+		}
+		else if(fb > fr) {
+			o1 = sg; o2 = sg + sb; t1 = fg; t2 = fb; t3 = fr;
+		}
+		else {
+			o1 = sg; o2 = 1 + sg; t1 = fg; t2 = fr; t3 = fb;
+		}
+	}
+	return c000[0] + (c000[o1] - c000[0]) * t1 + (c000[o2] - c000[o1]) * t2 + (c000[1 + sg + sb] - c000[o2]) * t3;
+}
+
+static void lut3d_rgb_rows(const Lut3D *lut, uint8_t *rgb, int linesize, int width, int height) {
+
+	int x, y;
+	uint8_t *p;
+	v4f o;
+
+	for(y = 0; y < height; y++, rgb += linesize) {
+		for(x = 0, p = rgb; x < width; x++, p += 3) {
+			o = lut3d_lookup(lut, lut->table, p[0], p[1], p[2]);
+			p[0] = (int)(o[0] + 0.5f);
+			p[1] = (int)(o[1] + 0.5f);
+			p[2] = (int)(o[2] + 0.5f);
+		}
+	}
+}
+
+/* YUV420P -> RGB -> LUT -> YUV420P in one pass over rows y0..y1 (y0 even),
+   BT.601 limited range, without an intermediate RGB picture. Chroma is
+   the mean of the four graded pixels it covers. */
+static void lut3d_yuv420p_rows(const Lut3D *lut, const AVFrame *src, AVFrame *dst, int y0, int y1) {
+
+	const uint8_t *sy[2], *su, *sv;
+	uint8_t *dy[2], *du, *dv;
+	int x, y, i, j, rows, c, d, e, rv, gv, bv, width = src->width;
+	float n;
+	v4f o, sum;
+
+	for(y = y0; y < y1; y += 2) {
+		rows = FFMIN(2, y1 - y);
+		sy[0] = src->data[0] + y * src->linesize[0];
+		sy[1] = sy[0] + src->linesize[0];
+		dy[0] = dst->data[0] + y * dst->linesize[0];
+		dy[1] = dy[0] + dst->linesize[0];
+		su = src->data[1] + (y >> 1) * src->linesize[1];
+		sv = src->data[2] + (y >> 1) * src->linesize[2];
+		du = dst->data[1] + (y >> 1) * dst->linesize[1];
+		dv = dst->data[2] + (y >> 1) * dst->linesize[2];
+
+		for(x = 0; x < width; x += 2) {
+			d = su[x >> 1] - 128;
+			e = sv[x >> 1] - 128;
+			rv = 409 * e + 128;
+			gv = -100 * d - 208 * e + 128;
+			bv = 516 * d + 128;
+			sum = (v4f){ 0, 0, 0, 0 };
+			n = 0;
+			for(j = 0; j < rows; j++) {
+				for(i = x; i < x + 2 && i < width; i++) {
+					c = 298 * (sy[j][i] - 16);
+					o = lut3d_lookup(lut, lut->table_yuv, av_clip_uint8((c + rv) >> 8), av_clip_uint8((c + gv) >> 8), av_clip_uint8((c + bv) >> 8));
+					dy[j][i] = (int)o[0];
+					sum += o;
+					n++;
+				}
+			}
+			sum /= n;
+			du[x >> 1] = (int)sum[1];
+			dv[x >> 1] = (int)sum[2];
+		}
+	}
+}
+
+/* the filters proper, on RGB24 rows */
+static void filter_rgb_rows(uint8_t *rgb, int linesize, int width, int height, int color_flag, const Lut3D *lut) {
+
+	int x, y, rgb_1, rgb_2;
+	uint8_t *p;
+
+	if(color_flag == 1) {
+		// black & white: average of the three channels (x * 21846 >> 16 == x / 3 for x <= 765)
+		for(y = 0; y < height; y++, rgb += linesize) {
+			for(x = 0, p = rgb; x < width; x++, p += 3)
+				p[0] = p[1] = p[2] = ((p[0] + p[1] + p[2]) * 21846) >> 16;
+		}
+	}
+	else if(color_flag > 1 && color_flag < 5) {
+		// keep one channel: 2 red, 3 green, 4 blue
+		if(color_flag == 2) {
+			rgb_1 = 1;
+			rgb_2 = 2;
+		}
+		else if(color_flag == 3) {
+			rgb_1 = 0;
+			rgb_2 = 2;
+		}
+		else {
+			rgb_1 = 0;
+			rgb_2 = 1;
+		}
+		for(y = 0; y < height; y++, rgb += linesize) {
+			for(x = 0, p = rgb; x < width; x++, p += 3)
+				p[rgb_1] = p[rgb_2] = 0;
+		}
+	}
+	else if(color_flag == 6 && lut) {
+		lut3d_rgb_rows(lut, rgb, linesize, width, height);
+	}
+}
+
+/* pointers to row 'y' of every plane of 'frame' */
+static void frame_slice_pointers(const AVFrame *frame, int y, uint8_t *data[4]) {
+
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+	int i, shift;
+
+	for(i = 0; i < 4; i++) {
+		shift = (i == 1 || i == 2) ? desc->log2_chroma_h : 0;
+		data[i] = frame->data[i] ? frame->data[i] + (y >> shift) * frame->linesize[i] : NULL;
+	}
+}
+
+static void color_filter_slice(void *arg, int slice, int nb_slices) {
+
+	ColorFilter *cf = arg;
+	int y = cf->slice_y[slice], h = cf->slice_y[slice + 1] - y;
+	uint8_t *src[4], *dst[4], *rgb[4] = { NULL };
+
+	if(cf->color_flag == 6 && cf->lut && cf->format == AV_PIX_FMT_YUV420P && cf->dst && !cf->keep_rgb) {
+		lut3d_yuv420p_rows(cf->lut, cf->src, cf->dst, y, y + h);
+		return;
+	}
+	rgb[0] = cf->rgb->data[0] + y * cf->rgb->linesize[0];
+	frame_slice_pointers(cf->src, y, src);
+	sws_scale(cf->to_rgb[slice], (uint8_t const * const *)src, cf->src->linesize, 0, h, rgb, cf->rgb->linesize);
+	filter_rgb_rows(rgb[0], cf->rgb->linesize[0], cf->width, h, cf->color_flag, cf->lut);
+	if(cf->dst) {
+		frame_slice_pointers(cf->dst, y, dst);
+		sws_scale(cf->from_rgb[slice], (uint8_t const * const *)rgb, cf->rgb->linesize, 0, h, dst, cf->dst->linesize);
+	}
+}
+
+/* Filter 'src' into 'dst' (same size and format) on the worker pool; with
+   no 'dst' only the RGB picture cf->rgb is produced. */
+int color_filter_run(ColorFilter *cf, const AVFrame *src, AVFrame *dst, int color_flag) {
+
+	if(color_filter_setup(cf, src->width, src->height, src->format) < 0)
+		return -1;
+	cf->src = src;
+	cf->dst = dst;
+	cf->color_flag = color_flag;
+	worker_pool_run(worker_pool, color_filter_slice, cf, cf->nb_slices);
+	return 0;
+}
+
+int file_exist(char *filename) {
+
+	struct stat buffer;   
+	return (!stat(filename, &buffer));
+}
+
+void gen_random(char *s, const int len) {
+
+	static const char alphanum[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+	for (int i = 0; i < len; ++i)
+		s[i] = alphanum[rand() % (sizeof(alphanum) - 1)];
+	s[len] = 0;
+}
+
+void savePicture(VideoState* is, AVFrame* pFrame) {
+
+	char name[15];
+	FILE *pFile;
+	int  y;
+	gen_random(name,10);
+	strcat(name,".ppm");
+
+	while (file_exist(name)) {
+		gen_random(name,10);
+		strcat(name,".ppm");
+	}
+
+	// Open file
+	pFile=fopen(name, "wb");
+	if(pFile==NULL) return;
+
+	// Write header
+	fprintf(pFile, "P6\n%d %d\n255\n", pFrame->width, pFrame->height);
+
+	// Write pixel data
+	for(y=0; y<pFrame->height; y++)
+		fwrite(pFrame->data[0]+y*pFrame->linesize[0], 1, pFrame->width*3, pFile);
+
+	// Close file
+	fclose(pFile);
+	if (file_exist(name))
+		printf("Screenshot %s has been successfully saved!\n",name);
+	else
+		fprintf(stderr,"Screenshot has been failed to save\n");
+}
+
+void toRGB(void *arguments) {
+
+	VideoState *is = (VideoState*)arguments;
+	AVFrame *pFrame = NULL, *pFrameOut = NULL, *pFiltered = NULL;
+	ColorFilter filter;
+	int color_flag, filtering;
+
+	memset(&filter, 0, sizeof(filter));
+	filter.lut = is->engine->lut;
+	// Allocate video frame
+	pFiltered = frame_alloc();
+	if(pFiltered==NULL) pthread_exit(NULL);
+
+	for(;;) {
+		SDL_LockMutex(is->colorq_mutex);
+		while(is->colorq_size == 0 && !is->quit) {
+			SDL_CondWait(is->colorq_cond, is->colorq_mutex);
+		}
+		SDL_UnlockMutex(is->colorq_mutex);
+
+		if(is->quit) {
+			color_filter_uninit(&filter);
+			av_frame_free(&pFiltered);
+			return;
+		}
+		pFrame = pFrameOut = is->colorq[is->colorq_rindex];
+
+		color_flag = is->color_flag;
+		if(!pFrame->buf[0])
+			color_flag = 0;	/* end of an exported channel, passed on as it is */
+		is->curr_pts = synchronize_video(is, pFrame, is->curr_pts);
+		if(live_picture_late(is, pFrame, is->curr_pts)) {
+			av_frame_unref(pFrame);
+			goto next;
+		}
+		filtering = (color_flag > 0 && color_flag < 5) || (color_flag == 6 && is->engine->lut);
+		if(filtering || is->save_picture_flag) {
+			/* the decoder may still reference pFrame for prediction, so
+			   the filtered picture goes to a pooled frame of our own */
+			pFiltered->format = pFrame->format;
+			pFiltered->width = pFrame->width;
+			pFiltered->height = pFrame->height;
+			if(filtering && frame_pool_get(&is->filter_pool, pFiltered, pFrame->width, pFrame->height) < 0)
+				filtering = 0;
+
+			filter.keep_rgb = is->save_picture_flag;
+			if((filtering || is->save_picture_flag) &&
+					!color_filter_run(&filter, pFrame, filtering ? pFiltered : NULL, filtering ? color_flag : 0)) {
+				if(filtering) {
+					pFiltered->repeat_pict = pFrame->repeat_pict;
+					pFiltered->reordered_opaque = pFrame->reordered_opaque;
+					pFrameOut = pFiltered;
+				}
+				if (is->save_picture_flag) {
+					is->save_picture_flag = 0;
+					savePicture(is,filter.rgb);
+				}
+			}
+		}
+		if(queue_picture(is, pFrameOut, is->curr_pts) < 0) {
+			/* quitting: the pictures go back to their pools */
+			av_frame_unref(pFrame);
+			break;
+		}
+		av_frame_unref(pFrame);
+		av_frame_unref(pFiltered);
+
+		next:
+		if(++is->colorq_rindex == VIDEO_PICTURE_QUEUE_SIZE)
+			is->colorq_rindex = 0;
+
+		SDL_LockMutex(is->colorq_mutex);
+		is->colorq_size--;
+		SDL_CondSignal(is->colorq_cond);
+		SDL_UnlockMutex(is->colorq_mutex);
+	}
+	color_filter_uninit(&filter);
+	av_frame_free(&pFiltered);
+}
+
+/* Nobody sees this channel: single view on the other one, and neither an
+   A/B view, the comparator nor the lock mode needs it. Engines without display show
+   everything. */
+static int channel_hidden(VideoState *is) {
+
+	PlayerEngine *e = is->engine;
+
+	return e->screen && !e->multi_videos && e->view == PLAYER_VIEW_STACKED && !e->comparator &&
+			!e->sync_lock && is != e->audio_channel;
+}
+
+/* Keep-up mode, video thread: take the packet when the clock gets to it,
+   as its picture would have been shown, and decode it only if it is a
+   keyframe (the decoder skips the others), so that the channel can be
+   shown again from the next keyframe. */
+static void keepup_packet(VideoState *is, AVPacket *packet, AVFrame *frame) {
+
+	int64_t ts = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+	double pts, wait;
+	int got;
+
+	if(ts != AV_NOPTS_VALUE) {
+		pts = ts * av_q2d(is->video_st->time_base) + is->video_src->pts_offset;
+		SDL_LockMutex(is->colorq_mutex);
+		while(!is->quit) {
+			wait = pts - get_master_clock(is);
+			if(is->engine->paused)
+				SDL_CondWait(is->colorq_cond, is->colorq_mutex);	/* player_toggle_pause wakes us */
+			else if(wait > 0 && wait < is->engine->nosync_threshold)
+				SDL_CondWaitTimeout(is->colorq_cond, is->colorq_mutex, (int)(wait * 1000) + 1);
+			else
+				break;
+		}
+		SDL_UnlockMutex(is->colorq_mutex);
+	}
+	/* intra-only: every picture can start again, none is needed */
+	if(is->decode_pool)
+		return;
+	is->video_st->codec->skip_frame = AVDISCARD_NONKEY;
+	avcodec_decode_video2(is->video_st->codec, frame, &got, packet);
+	av_frame_unref(frame);
+}
+
+/* hand a decoded frame to the color (toRGB) thread, without copying it */
+static int queue_color_frame(VideoState *is, AVFrame *pFrame, double pts, int item_start) {
+
+	SDL_LockMutex(is->colorq_mutex);
+	while(is->colorq_size >= VIDEO_PICTURE_QUEUE_SIZE && !is->quit) {
+		SDL_CondWait(is->colorq_cond, is->colorq_mutex);
+	}
+	SDL_UnlockMutex(is->colorq_mutex);
+	if(is->quit) return -1;
+
+	is->curr_pts = pts;
+	is->curr_item_start = item_start;
+	is->curr_serial = is->video_serial;
+	/* the reference moves to the queue; pFrame is left empty */
+	av_frame_move_ref(is->colorq[is->colorq_windex], pFrame);
+
+	if(++is->colorq_windex == VIDEO_PICTURE_QUEUE_SIZE) {
+		is->colorq_windex = 0;
+	}
+	SDL_LockMutex(is->colorq_mutex);
+	is->colorq_size++;
+	SDL_CondSignal(is->colorq_cond);
+	SDL_UnlockMutex(is->colorq_mutex);
+	return 0;
+}
+
+/* Video thread: hand a picture to the verifier; like queue_color_frame
+   the reference moves and 'frame' is left empty. An empty picture marks
+   the end of the channel. */
+static int verifier_put(Verifier *v, int channel, AVFrame *frame, double pts) {
+
+	VerifyChannel *vc = &v->channels[channel];
+	VerifyHash **blocks;
+	int ret = 0;
+
+	pthread_mutex_lock(&v->mutex);
+	if(!frame->buf[0]) {
+		vc->ended = 1;
+		pthread_cond_broadcast(&v->cond);
+		pthread_mutex_unlock(&v->mutex);
+		return 0;
+	}
+	while(vc->in_flight >= VERIFY_QUEUE_SIZE && !v->quit) {
+		pthread_cond_wait(&v->cond, &v->mutex);
+	}
+	if(vc->count == vc->nb_blocks * VERIFY_BLOCK_SIZE) {
+		/* the threads only ever see the blocks, never the array */
+		blocks = av_realloc(vc->blocks, (vc->nb_blocks + 1) * sizeof(*blocks));
+		if(blocks)
+			vc->blocks = blocks;
+		if(!blocks || !(blocks[vc->nb_blocks] = av_malloc(VERIFY_BLOCK_SIZE * sizeof(VerifyHash))))
+			ret = -1;
+		else
+			vc->nb_blocks++;
+	}
+	if(v->quit || ret < 0) {
+		pthread_mutex_unlock(&v->mutex);
+		return -1;
+	}
+	av_frame_move_ref(v->queue[v->windex].frame, frame);
+	vc->blocks[vc->count / VERIFY_BLOCK_SIZE][vc->count % VERIFY_BLOCK_SIZE].pts = pts;
+	v->queue[v->windex].channel = channel;
+	v->queue[v->windex].n = vc->count++;
+	if(++v->windex == FF_ARRAY_ELEMS(v->queue))
+		v->windex = 0;
+	v->queue_size++;
+	vc->in_flight++;
+	pthread_cond_broadcast(&v->cond);
+	pthread_mutex_unlock(&v->mutex);
+	return 0;
+}
+
+/* time of a packet on the playlist timeline, its dts if it has one; -1
+   when it has no timestamp */
+static double packet_time(AVStream *st, MediaSource *src, AVPacket *pkt) {
+
+	int64_t ts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+
+	if(ts == AV_NOPTS_VALUE)
+		return -1;
+	return ts * av_q2d(st->time_base) + src->pts_offset;
+}
+
+static void loop_frames_free(VideoState *is) {
+
+	int i;
+
+	for(i = 0; i < is->nb_loop_frames; i++)
+		av_frame_free(&is->loop_frames[i].frame);
+	av_freep(&is->loop_frames);
+	is->nb_loop_frames = is->loop_frames_alloc = is->loop_frame_next = 0;
+	mem_charge(&is->mem_cache, -is->loop_frame_bytes);
+	is->loop_frame_bytes = 0;
+	is->loop_frames_state = LOOP_FRAMES_NONE;
+}
+
+/* Can the loop caches of a channel take 'size' more bytes? Under
+   -membudget they are charged like everything else and may take what the
+   packet queues of all channels do not need at the least. */
+static int loop_fits(VideoState *is, int64_t size) {
+
+	if(!mem_budget.budget)
+		return is->loop.bytes + is->loop_frame_bytes + size <= LOOP_MAX_SIZE;
+	return mem_budget.fixed + size <= mem_budget.budget - 2 * MIN_QUEUE_BUDGET;
+}
+
+/* first pass through the loop: keep a reference to the picture, unless
+   the pictures outgrow what the packets left of the budget */
+static void loop_frames_add(VideoState *is, AVFrame *frame, double pts) {
+
+	LoopFrame *frames;
+	int64_t size = 0;
+	int i, alloc;
+
+	for(i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++)
+		size += frame->buf[i]->size;
+	if(is->nb_loop_frames == is->loop_frames_alloc) {
+		alloc = FFMAX(64, 2 * is->loop_frames_alloc);
+		frames = av_realloc(is->loop_frames, alloc * sizeof(*frames));
+		if(frames) {
+			is->loop_frames = frames;
+			is->loop_frames_alloc = alloc;
+		}
+	}
+	if(is->nb_loop_frames == is->loop_frames_alloc ||
+			!loop_fits(is, size) ||
+			!(is->loop_frames[is->nb_loop_frames].frame = av_frame_clone(frame))) {
+		loop_frames_free(is);
+		is->loop_frames_state = LOOP_FRAMES_OVER;
+		return;
+	}
+	is->loop_frames[is->nb_loop_frames++].pts = pts;
+	is->loop_frame_bytes += size;
+	mem_charge(&is->mem_cache, size);
+}
+
+/* decoded pictures go to the color filter thread, or to the verifier */
+static int video_output_frame(VideoState *is, AVFrame *pFrame, double pts, int item_start) {
+
+	if(pFrame->buf[0])
+		is->video_pictures++;
+	if(pFrame->buf[0] && !is->first_picture_time)
+		is->first_picture_time = av_gettime();
+	/* A-B loop: the pictures from the keyframe to A were only decoded for
+	   the ones after them */
+	if(is->loop_b > 0 && pFrame->buf[0] && pts > 0) {
+		if(pts < is->loop_a || pts > is->loop_b) {
+			av_frame_unref(pFrame);
+			return 0;
+		}
+		if(is->loop_frames_state == LOOP_FRAMES_RECORDING)
+			loop_frames_add(is, pFrame, pts);
+	}
+	if(is->engine->verifier)
+		return verifier_put(is->engine->verifier, is->is_small, pFrame, pts);
+	return queue_color_frame(is, pFrame, pts, item_start);
+}
+
+/* timestamp of a decoded picture, in the time base of its stream: the
+   dts of its packet, else the pts of the packet that started it */
+static int64_t video_frame_ts(int64_t dts, AVFrame *frame) {
+
+	if(dts == AV_NOPTS_VALUE)
+		return frame->pkt_pts;
+	return dts;
+}
+
+/* pts of a decoded picture on the channel's timeline */
+static double video_frame_pts(VideoState *is, int64_t dts, AVFrame *frame) {
+
+	int64_t ts = video_frame_ts(dts, frame);
+	double pts;
+
+	pts = ts == AV_NOPTS_VALUE ? 0 : ts * av_q2d(is->video_st->time_base);
+	if(pts != 0)
+		pts += is->video_src->pts_offset;
+	return pts;
+}
+
+/* A-B loop: show the kept pictures of the repeat up to 'until' */
+static int loop_frames_output(VideoState *is, AVFrame *frame, double until) {
+
+	LoopFrame *lf;
+
+	while(is->loop_frame_next < is->nb_loop_frames && is->loop_frames[is->loop_frame_next].pts <= until) {
+		lf = &is->loop_frames[is->loop_frame_next++];
+		if(frame_ref(frame, lf->frame) < 0)
+			continue;
+		if(video_output_frame(is, frame, lf->pts, 0) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* get the pictures the decoder still holds out of it */
+static int video_drain_decoder(VideoState *is, AVFrame *frame, int *item_start) {
+
+	AVPacket drain;
+	int got;
+
+	av_init_packet(&drain);
+	drain.data = NULL;
+	drain.size = 0;
+	do {
+		got = 0;
+		avcodec_decode_video2(is->video_st->codec, frame, &got, &drain);
+		if(got && video_output_frame(is, frame, video_frame_pts(is, AV_NOPTS_VALUE, frame), *item_start) < 0)
+			return -1;
+		if(got)
+			*item_start = 0;
+	} while(got);
+	av_frame_unref(frame);
+	avcodec_flush_buffers(is->video_st->codec);
+	return 0;
+}
+
+static void *decode_pool_thread(void *arg) {
+
+	DecodeWorker *w = arg;
+	DecodePool *dp = w->dp;
+	DecodeJob *job;
+	AVPacket drain;
+	int got;
+
+	pthread_mutex_lock(&dp->mutex);
+	for(;;) {
+		while(dp->taken == dp->submitted && !dp->quit) {
+			pthread_cond_wait(&dp->cond, &dp->mutex);
+		}
+		if(dp->quit)
+			break;
+		job = &dp->jobs[dp->taken++ % dp->nb_jobs];
+		pthread_mutex_unlock(&dp->mutex);
+
+		got = 0;
+		if(avcodec_decode_video2(w->ctx, job->frame, &got, &job->pkt) >= 0 && !got) {
+			/* a decoder with delay: get the picture out and start afresh */
+			av_init_packet(&drain);
+			drain.data = NULL;
+			drain.size = 0;
+			avcodec_decode_video2(w->ctx, job->frame, &got, &drain);
+			avcodec_flush_buffers(w->ctx);
+		}
+		if(!got)
+			av_frame_unref(job->frame);
+		job->frame->reordered_opaque = job->arrival;
+
+		pthread_mutex_lock(&dp->mutex);
+		job->done = 1;
+		pthread_cond_broadcast(&dp->cond);
+	}
+	pthread_mutex_unlock(&dp->mutex);
+	return NULL;
+}
+
+static void decode_pool_free(DecodePool *dp) {
+
+	DecodeWorker *w;
+	int i;
+
+	if(!dp)
+		return;
+	pthread_mutex_lock(&dp->mutex);
+	dp->quit = 1;
+	pthread_cond_broadcast(&dp->cond);
+	pthread_mutex_unlock(&dp->mutex);
+	for(i = 0; i < dp->nb_workers; i++) {
+		w = &dp->workers[i];
+		if(w->thread)
+			pthread_join(w->thread, NULL);
+		if(w->ctx) {
+			avcodec_close(w->ctx);
+			avcodec_free_context(&w->ctx);
+		}
+		frame_pool_uninit(&w->pool);
+	}
+	for(i = 0; i < dp->nb_jobs; i++) {
+		av_free_packet(&dp->jobs[i].pkt);
+		av_frame_free(&dp->jobs[i].frame);
+	}
+	pthread_mutex_destroy(&dp->mutex);
+	pthread_cond_destroy(&dp->cond);
+	av_free(dp);
+}
+
+static int codec_intra_only(enum AVCodecID id) {
+
+	const AVCodecDescriptor *desc = avcodec_descriptor_get(id);
+
+	return desc && (desc->props & AV_CODEC_PROP_INTRA_ONLY);
+}
+
+/* A decode pool for the video stream of 'is' if every picture of it is a
+   keyframe: the codec says so, or it is H.264 and INTRA_PROBE_PACKETS
+   packets in a row were keyframes. NULL otherwise, or with less than two
+   decoders to give it. */
+static DecodePool *decode_pool_open(VideoState *is) {
+
+	AVCodecContext *codecCtx = is->video_st->codec;
+	DecodePool *dp;
+	DecodeWorker *w;
+	int i, n = is->engine->cfg.intra_decoders;
+
+	if(n < 0)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	n = FFMIN(n, MAX_DECODERS);
+	if(n < 2)
+		return NULL;
+	if(!codec_intra_only(codecCtx->codec_id) &&
+			!(codecCtx->codec_id == AV_CODEC_ID_H264 && codecCtx->extradata_size && is->intra_run >= INTRA_PROBE_PACKETS))
+		return NULL;
+	if(!(dp = av_mallocz(sizeof(DecodePool))))
+		return NULL;
+	pthread_mutex_init(&dp->mutex, NULL);
+	pthread_cond_init(&dp->cond, NULL);
+	dp->nb_jobs = 2 * n;
+	for(i = 0; i < dp->nb_jobs; i++) {
+		if(!(dp->jobs[i].frame = frame_alloc()))
+			goto fail;
+	}
+	for(dp->nb_workers = 0; dp->nb_workers < n; dp->nb_workers++) {
+		w = &dp->workers[dp->nb_workers];
+		w->dp = dp;
+		w->pool.usage = &is->mem_frames;
+		if(!(w->ctx = avcodec_alloc_context3(NULL)) || avcodec_copy_context(w->ctx, codecCtx) < 0)
+			goto fail;
+		/* the parallelism is ours: no frame threads and their delay */
+		w->ctx->thread_count = 1;
+		w->ctx->refcounted_frames = 1;
+		w->ctx->get_buffer2 = our_get_buffer;
+		w->ctx->opaque = &w->pool;
+		if(avcodec_open2(w->ctx, avcodec_find_decoder(codecCtx->codec_id), NULL) < 0)
+			goto fail;
+		/* every job waits for its own picture: a decoder that holds
+		   pictures back (delay, reordering) is left to decode inline */
+		if(w->ctx->delay || w->ctx->has_b_frames) {
+			fprintf(stderr, "Channel %d: %s holds pictures back, not decoded in parallel\n",
+					is->is_small ? 2 : 1, avcodec_get_name(codecCtx->codec_id));
+			dp->nb_workers++;
+			decode_pool_free(dp);
+			return NULL;
+		}
+		if(pthread_create(&w->thread, NULL, decode_pool_thread, w))
+			goto fail;
+	}
+	is->intra_decoders = dp->nb_workers;
+	fprintf(stderr, "Channel %d: intra-only %s, %d decoders\n", is->is_small ? 2 : 1,
+			avcodec_get_name(codecCtx->codec_id), dp->nb_workers);
+	return dp;
+
+fail:
+	fprintf(stderr, "Channel %d: could not start the intra-only decoders\n", is->is_small ? 2 : 1);
+	if(dp->nb_workers < n && dp->workers[dp->nb_workers].ctx)
+		dp->nb_workers++;	/* the one that failed has its context to free */
+	decode_pool_free(dp);
+	return NULL;
+}
+
+static int decode_pool_full(DecodePool *dp) {
+
+	return dp->submitted - dp->output == dp->nb_jobs;
+}
+
+/* Video thread: the packet goes to a decoder; the reference moves. */
+static void decode_pool_send(DecodePool *dp, AVPacket *pkt, int64_t arrival) {
+
+	DecodeJob *job;
+
+	pthread_mutex_lock(&dp->mutex);
+	job = &dp->jobs[dp->submitted++ % dp->nb_jobs];
+	job->pkt = *pkt;
+	job->arrival = arrival;
+	job->done = 0;
+	pthread_cond_broadcast(&dp->cond);
+	pthread_mutex_unlock(&dp->mutex);
+}
+
+/* Video thread: the oldest job into 'frame' and 'dts', waiting for it
+   with 'block'. Returns 1 with a picture, 0 if its packet gave none, -1
+   when no job is done (or there is none). */
+static int decode_pool_receive(DecodePool *dp, AVFrame *frame, int64_t *dts, int block) {
+
+	DecodeJob *job = &dp->jobs[dp->output % dp->nb_jobs];
+
+	pthread_mutex_lock(&dp->mutex);
+	while(block && dp->output < dp->submitted && !job->done) {
+		pthread_cond_wait(&dp->cond, &dp->mutex);
+	}
+	if(dp->output == dp->submitted || !job->done) {
+		pthread_mutex_unlock(&dp->mutex);
+		return -1;
+	}
+	dp->output++;
+	pthread_mutex_unlock(&dp->mutex);
+	*dts = job->pkt.dts;
+	av_free_packet(&job->pkt);
+	av_frame_move_ref(frame, job->frame);
+	return frame->buf[0] ? 1 : 0;
+}
+
+/* Video thread: pass the pictures of the pool on in order, waiting for
+   the first 'wait' of them (INT_MAX: all) and taking the rest that are
+   done. With 'drop' they are thrown away instead (seeks). */
+static int decode_pool_output(VideoState *is, AVFrame *frame, int wait, int drop, int *item_start) {
+
+	int64_t dts;
+	int ret;
+
+	while((ret = decode_pool_receive(is->decode_pool, frame, &dts, wait > 0)) >= 0) {
+		wait--;
+		if(!ret)
+			continue;
+		if(drop) {
+			av_frame_unref(frame);
+			continue;
+		}
+		if(video_output_frame(is, frame, video_frame_pts(is, dts, frame), *item_start) < 0)
+			return -1;
+		*item_start = 0;
+	}
+	return 0;
+}
+
+int video_thread(void *arg) {
+
+	VideoState *is = (VideoState *)arg;
+	AVPacket pkt1, *packet = &pkt1;
+	int frameFinished, item_start = 0, i;
+	AVFrame *pFrame;
+	double pts;
+
+	int rc;
+	// the queue slots are allocated once; frames move in and out of them
+	for(i = 0; i < VIDEO_PICTURE_QUEUE_SIZE; i++)
+		is->colorq[i] = frame_alloc();
+	rc = pthread_create(&is->color_tid, NULL, (void*)toRGB, is);
+	if (rc) {
+		fprintf(stderr,"ERROR; return code from pthread_create() is %d\n", rc);
+		exit(-1);
+	}
+	is->color_started = 1;
+
+	pFrame = frame_alloc();
+	is->decode_pool = decode_pool_open(is);
+	for(;;) {
+		if(packet_queue_get(&is->videoq, packet, 1) < 0) {
+			// means we quit getting packets
+			break;
+		}
+		demux_wake(is);
+		if(packet->data == flush_pkt.data) {
+			avcodec_flush_buffers(is->video_st->codec);
+			if(is->decode_pool)
+				decode_pool_output(is, pFrame, INT_MAX, 1, &item_start);
+			is->video_serial = is->seek_serial;
+			/* a loop keeps its pictures from the seek back to A on */
+			loop_frames_free(is);
+			if(is->loop_b > 0)
+				is->loop_frames_state = is->loop.nocache ? LOOP_FRAMES_OVER : LOOP_FRAMES_RECORDING;
+			continue;
+		}
+		if(packet->data == loop_pkt.data) {
+			/* a repeat starts: once every picture of the loop is kept, the
+			   repeats are shown from memory and not decoded */
+			if(is->loop_frames_state == LOOP_FRAMES_RECORDING) {
+				if(is->decode_pool)
+					i = decode_pool_output(is, pFrame, INT_MAX, 0, &item_start);
+				else
+					i = video_drain_decoder(is, pFrame, &item_start);
+				if(i < 0)
+					break;
+				if(is->loop_frames_state == LOOP_FRAMES_RECORDING) {
+					is->loop_frames_state = LOOP_FRAMES_COMPLETE;
+					fprintf(stderr, "Channel %d: %d pictures of the loop kept (%.1f MB), repeats are not decoded\n",
+							is->is_small ? 2 : 1, is->nb_loop_frames, is->loop_frame_bytes / 1048576.0);
+				}
+			}
+			else if(is->loop_frames_state == LOOP_FRAMES_COMPLETE && loop_frames_output(is, pFrame, is->loop_b) < 0)
+				break;
+			is->loop_frame_next = 0;
+			continue;
+		}
+		if(is->loop_frames_state == LOOP_FRAMES_COMPLETE) {
+			/* the packets of a repeat only pace the kept pictures */
+			pts = packet_time(is->video_st, is->video_src, packet);
+			av_free_packet(packet);
+			if(loop_frames_output(is, pFrame, pts) < 0)
+				break;
+			continue;
+		}
+		if(packet->data == eof_pkt.data) {
+			/* export and verify modes: get the pictures the decoder still
+			   holds, then send an empty frame down to mark the end */
+			AVPacket drain;
+
+			if(is->decode_pool && decode_pool_output(is, pFrame, INT_MAX, 0, &item_start) < 0)
+				break;
+			av_init_packet(&drain);
+			drain.data = NULL;
+			drain.size = 0;
+			do {
+				frameFinished = 0;
+				avcodec_decode_video2(is->video_st->codec, pFrame, &frameFinished, &drain);
+				if(frameFinished && video_output_frame(is, pFrame, 0, item_start) < 0)
+					break;
+				item_start = 0;
+			} while(frameFinished);
+			av_frame_unref(pFrame);
+			if(video_output_frame(is, pFrame, 0, 0) < 0)
+				break;
+			continue;
+		}
+		if(packet->data == switch_pkt.data) {
+			/* next playlist item: its first frame was decoded ahead of time,
+			   so it can be queued right behind the last frame of this one */
+			MediaSource *src;
+
+			if(is->decode_pool) {
+				if(decode_pool_output(is, pFrame, INT_MAX, 0, &item_start) < 0)
+					break;
+				decode_pool_free(is->decode_pool);
+				is->decode_pool = NULL;
+			}
+			is->video_src->video_done = 1;
+			src = is->video_src = source_advance(is, is->video_src);
+			is->video_st = src->pFormatCtx->streams[src->videoStream];
+			is->intra_run = 0;
+			is->intra_decoders = 0;
+			is->decode_pool = decode_pool_open(is);
+			item_start = 1;
+			/* after a seek the primed frame is not where we are */
+			if(src->primed_frame && src->serial == is->seek_serial) {
+				pts = src->primed_pts ? src->primed_pts + src->pts_offset : 0;
+				if(video_output_frame(is, src->primed_frame, pts, 1) < 0)
+					break;
+				item_start = 0;
+			}
+			av_frame_free(&src->primed_frame);
+			continue;
+		}
+		/* nobody sees us: no decoding but keyframes, no color or scale
+		   work; shown again, we resume on a keyframe since the pictures
+		   in between refer to ones that were skipped */
+		if(channel_hidden(is))
+			is->keepup = 1;
+		if(is->keepup) {
+			if(is->decode_pool)
+				decode_pool_output(is, pFrame, INT_MAX, 1, &item_start);
+			if(channel_hidden(is) || !(packet->flags & AV_PKT_FLAG_KEY)) {
+				keepup_packet(is, packet, pFrame);
+				av_free_packet(packet);
+				continue;
+			}
+			is->keepup = 0;
+			is->keepup_resync = 1;
+			is->video_st->codec->skip_frame = AVDISCARD_DEFAULT;
+		}
+
+		/* H.264 gives no sign of being all-intra but its packets */
+		if(is->intra_run >= 0 && !is->decode_pool) {
+			is->intra_run = packet->flags & AV_PKT_FLAG_KEY ? is->intra_run + 1 : -1;
+			/* the pictures our decoder still holds go first */
+			if(is->intra_run == INTRA_PROBE_PACKETS && (is->decode_pool = decode_pool_open(is)) &&
+					video_drain_decoder(is, pFrame, &item_start) < 0) {
+				av_free_packet(packet);
+				break;
+			}
+		}
+		else if(is->decode_pool && !(packet->flags & AV_PKT_FLAG_KEY) &&
+				!codec_intra_only(is->video_st->codec->codec_id)) {
+			/* not all-intra after all: back to one decoder, which picks up
+			   properly at the next keyframe */
+			is->intra_run = -1;
+			if(decode_pool_output(is, pFrame, INT_MAX, 0, &item_start) < 0) {
+				av_free_packet(packet);
+				break;
+			}
+			decode_pool_free(is->decode_pool);
+			is->decode_pool = NULL;
+			is->intra_decoders = 0;
+		}
+		if(is->decode_pool) {
+			/* out of order on the decoders, back in order here; the pool
+			   takes the packet */
+			if(decode_pool_output(is, pFrame, decode_pool_full(is->decode_pool), 0, &item_start) < 0) {
+				av_free_packet(packet);
+				break;
+			}
+			decode_pool_send(is->decode_pool, packet, is->videoq.last_arrival);
+			if(decode_pool_output(is, pFrame, 0, 0, &item_start) < 0)
+				break;
+			continue;
+		}
+
+		// Decode video frame; the arrival time travels with the picture
+		is->video_st->codec->reordered_opaque = is->videoq.last_arrival;
+		avcodec_decode_video2(is->video_st->codec, pFrame, &frameFinished,packet);
+		// pkt_pts is the pts of the packet that started this picture
+		pts = video_frame_pts(is, packet->dts, pFrame);
+
+		// Did we get a video frame?
+		if(frameFinished) {
+			if(video_output_frame(is, pFrame, pts, item_start) < 0) {
+				av_free_packet(packet);
+				break;
+			}
+			item_start = 0;
+		}
+
+		av_free_packet(packet);
+	}
+	decode_pool_free(is->decode_pool);
+	is->decode_pool = NULL;
+	av_frame_free(&pFrame);
+	return 0;
+}
+
+
+/* open the decoder of one stream; done for every playlist item before it plays */
+static int stream_open_codec(AVCodecContext *codecCtx) {
+
+	AVCodec *codec = NULL;
+	AVDictionary *optionsDict = NULL;
+
+	codec = avcodec_find_decoder(codecCtx->codec_id);
+	if(!codec || (avcodec_open2(codecCtx, codec, &optionsDict) < 0)) {
+		fprintf(stderr, "Unsupported codec!\n");
+		return -1;
+	}
+	if(codecCtx->codec_type == AVMEDIA_TYPE_VIDEO) {
+		/* frames we get are our references and can move to the color
+		   thread as they are */
+		codecCtx->refcounted_frames = 1;
+		codecCtx->get_buffer2 = our_get_buffer;
+	}
+	return 0;
+}
+
+int stream_component_open(VideoState *is, int stream_index) {
+
+	PlayerEngine *e = is->engine;
+	AVFormatContext *pFormatCtx = is->pFormatCtx;
+	AVCodecContext *codecCtx = NULL;
+
+	if(stream_index < 0 || stream_index >= pFormatCtx->nb_streams) return -1;
+	// Get a pointer to the codec context for the video stream
+	codecCtx = pFormatCtx->streams[stream_index]->codec;
+
+	if(codecCtx->codec_type == AVMEDIA_TYPE_AUDIO) {
+		if(!is->is_small && e->cfg.audio_device && !e->headless) {
+			// Set audio settings from codec info
+			e->wanted_spec.freq = codecCtx->sample_rate;
+			e->wanted_spec.format = AUDIO_S16SYS;
+			e->wanted_spec.channels = codecCtx->channels;
+			e->wanted_spec.silence = 0;
+			e->wanted_spec.samples = SDL_AUDIO_BUFFER_SIZE;
+			e->wanted_spec.callback = audio_callback_manager;
+			e->wanted_spec.userdata = is;
+
+				/* one device per process: a second engine asking for it fails here */
+				if(SDL_OpenAudio(&e->wanted_spec, &e->spec) < 0) {
+					fprintf(stderr, "SDL_OpenAudio: %s\n", SDL_GetError());
+					return -1;
+				}
+				e->audio_open = 1;
+		}
+		if(!is->is_small && e->virtual_clock) {
+			/* virtual clock: player_simulate plays the buffers of an
+			   audio device that is never opened */
+			e->spec.freq = codecCtx->sample_rate;
+			e->spec.format = AUDIO_S16SYS;
+			e->spec.channels = codecCtx->channels;
+			e->spec.samples = SDL_AUDIO_BUFFER_SIZE;
+			e->spec.size = SDL_AUDIO_BUFFER_SIZE * 2 * codecCtx->channels;
+		}
+		is->audio_hw_buf_size = e->spec.size;
+	}
+
+	switch(codecCtx->codec_type) {
+	case AVMEDIA_TYPE_AUDIO:
+		is->audioStream = stream_index;
+		is->audio_st = pFormatCtx->streams[stream_index];
+		is->audio_buf_size = 0;
+		is->audio_buf_index = 0;
+
+		/* averaging filter for audio sync */
+		is->audio_diff_avg_coef = exp(log(0.01 / AUDIO_DIFF_AVG_NB));
+		is->audio_diff_avg_count = 0;
+		/* Correct audio only if larger error than this */
+		is->audio_diff_threshold = 2.0 * SDL_AUDIO_BUFFER_SIZE / codecCtx->sample_rate;
+
+		is->sws_ctx_audio = (void*)swr_alloc();
+		if (!is->sws_ctx_audio) {
+			fprintf(stderr, "Could not allocate resampler context\n");
+			return -1;
+		}
+
+		memset(&is->audio_pkt, 0, sizeof(is->audio_pkt));
+		is->audioq.time_base = is->audio_st->time_base;
+		if(e->audio_open)
+			SDL_PauseAudio(e->paused);
+		break;
+	case AVMEDIA_TYPE_VIDEO:
+		is->videoStream = stream_index;
+		is->video_st = pFormatCtx->streams[stream_index];
+
+		is->frame_timer = (double)engine_time(e) / 1000000.0;
+		is->frame_last_delay = 40e-3;
+		is->video_current_pts_time = engine_time(e);
+
+		is->videoq.time_base = is->video_st->time_base;
+		is->video_tid = SDL_CreateThread(video_thread, is);
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
+int decode_interrupt_cb(void *opaque) {
+
+	VideoState *is = opaque;
+	return is->quit;
+}
+
+/* keep track of where the item ends on the timeline */
+static void source_track_end(MediaSource *src, AVPacket *packet) {
+
+	AVStream *st = src->pFormatCtx->streams[packet->stream_index];
+	double end;
+
+	if(packet->pts != AV_NOPTS_VALUE) {
+		end = (packet->pts + packet->duration) * av_q2d(st->time_base);
+		if(end > src->end_pts)
+			src->end_pts = end;
+	}
+}
+
+/* route a packet of 'src' to the audio or video queue, with its duration
+   converted to the time base of that queue */
+static void source_queue_packet(MediaSource *src, AVPacket *packet, PacketQueue *audioq, PacketQueue *videoq) {
+
+	PacketQueue *q = NULL;
+
+	if(packet->stream_index == src->videoStream) q = videoq;
+	else if(packet->stream_index == src->audioStream) q = audioq;
+	if(!q) {
+		av_free_packet(packet);
+		return;
+	}
+	source_track_end(src, packet);
+	packet->duration = av_rescale_q(packet->duration, src->pFormatCtx->streams[packet->stream_index]->time_base, q->time_base);
+	packet_queue_put(q, packet);
+}
+
+static void probe_cache_entry_clear(ProbeCacheEntry *e) {
+
+	int i;
+
+	for(i = 0; i < e->nb_streams; i++) {
+		avcodec_free_context(&e->codec[i]);
+	}
+	av_freep(&e->codec);
+	av_freep(&e->r_frame_rate);
+	av_freep(&e->avg_frame_rate);
+	memset(e, 0, sizeof(*e));
+}
+
+/* copy cached parameters into a freshly opened demuxer; fails when the
+   streams found by avformat_open_input don't match the cached ones */
+static int probe_cache_lookup(AVFormatContext *pFormatCtx, struct stat *st) {
+
+	ProbeCacheEntry *e;
+	int i, j, ret = -1;
+
+	pthread_mutex_lock(&probe_cache_mutex);
+	for(i = 0; i < PROBE_CACHE_SIZE; i++) {
+		e = &probe_cache[i];
+		if(!e->nb_streams || e->dev != st->st_dev || e->ino != st->st_ino ||
+				e->size != st->st_size || e->mtime != st->st_mtime)
+			continue;
+		if(e->nb_streams != pFormatCtx->nb_streams)
+			break;
+		for(j = 0; j < e->nb_streams; j++) {
+			if(e->codec[j]->codec_id != pFormatCtx->streams[j]->codec->codec_id)
+				break;
+		}
+		if(j < e->nb_streams)
+			break;
+		for(j = 0; j < e->nb_streams; j++) {
+			avcodec_copy_context(pFormatCtx->streams[j]->codec, e->codec[j]);
+			pFormatCtx->streams[j]->r_frame_rate = e->r_frame_rate[j];
+			pFormatCtx->streams[j]->avg_frame_rate = e->avg_frame_rate[j];
+		}
+		pFormatCtx->start_time = e->start_time;
+		pFormatCtx->duration = e->duration;
+		ret = 0;
+		break;
+	}
+	pthread_mutex_unlock(&probe_cache_mutex);
+	return ret;
+}
+
+static void probe_cache_store(AVFormatContext *pFormatCtx, struct stat *st) {
+
+	ProbeCacheEntry *e;
+	int i;
+
+	pthread_mutex_lock(&probe_cache_mutex);
+	e = &probe_cache[probe_cache_next];
+	probe_cache_next = (probe_cache_next + 1) % PROBE_CACHE_SIZE;
+	probe_cache_entry_clear(e);
+	e->codec = av_mallocz(pFormatCtx->nb_streams * sizeof(*e->codec));
+	e->r_frame_rate = av_mallocz(pFormatCtx->nb_streams * sizeof(*e->r_frame_rate));
+	e->avg_frame_rate = av_mallocz(pFormatCtx->nb_streams * sizeof(*e->avg_frame_rate));
+	if(e->codec && e->r_frame_rate && e->avg_frame_rate) {
+		for(i = 0; i < pFormatCtx->nb_streams; i++) {
+			e->codec[i] = avcodec_alloc_context3(NULL);
+			if(!e->codec[i] || avcodec_copy_context(e->codec[i], pFormatCtx->streams[i]->codec) < 0)
+				break;
+			e->r_frame_rate[i] = pFormatCtx->streams[i]->r_frame_rate;
+			e->avg_frame_rate[i] = pFormatCtx->streams[i]->avg_frame_rate;
+		}
+		e->nb_streams = i;
+		if(i < pFormatCtx->nb_streams)
+			probe_cache_entry_clear(e);
+	}
+	e->dev = st->st_dev;
+	e->ino = st->st_ino;
+	e->size = st->st_size;
+	e->mtime = st->st_mtime;
+	e->start_time = pFormatCtx->start_time;
+	e->duration = pFormatCtx->duration;
+	pthread_mutex_unlock(&probe_cache_mutex);
+}
+
+/* are the parameters we need to set up playback known for every stream? */
+static int stream_params_complete(AVFormatContext *pFormatCtx) {
+
+	AVCodecContext *c;
+	int i;
+
+	for(i = 0; i < pFormatCtx->nb_streams; i++) {
+		c = pFormatCtx->streams[i]->codec;
+		if(c->codec_type == AVMEDIA_TYPE_VIDEO && (!c->width || !c->height || c->pix_fmt == AV_PIX_FMT_NONE))
+			return 0;
+		if(c->codec_type == AVMEDIA_TYPE_AUDIO && (!c->sample_rate || !c->channels || c->sample_fmt == AV_SAMPLE_FMT_NONE))
+			return 0;
+	}
+	return 1;
+}
+
+/* Retrieve stream information, from the probe cache when this file was
+   probed before. In fast start mode a short probe is tried first and the
+   decoders work out what it did not; the full probe only runs when
+   playback could not be set up from it. */
+static int source_probe(AVFormatContext *pFormatCtx, const char *filename, const PlayerConfig *cfg) {
+
+	struct stat st;
+	int cacheable = !stat(filename, &st) && S_ISREG(st.st_mode);
+
+	if(cacheable && !probe_cache_lookup(pFormatCtx, &st))
+		return 0;
+	if(avformat_find_stream_info(pFormatCtx, NULL) < 0)
+		return -1;
+	if(cfg->fast_start && !stream_params_complete(pFormatCtx)) {
+		av_opt_set_int(pFormatCtx, "probesize", cfg->probe_size ? cfg->probe_size : 5000000, 0);
+		av_opt_set_int(pFormatCtx, "analyzeduration", cfg->analyze_duration ? cfg->analyze_duration : 5 * AV_TIME_BASE, 0);
+		if(avformat_find_stream_info(pFormatCtx, NULL) < 0)
+			return -1;
+	}
+	if(cacheable && stream_params_complete(pFormatCtx))
+		probe_cache_store(pFormatCtx, &st);
+	return 0;
+}
+
+static void source_free(MediaSource *src) {
+
+	int i;
+
+	if(src->pFormatCtx) {
+		for(i = 0; i < src->pFormatCtx->nb_streams; i++) {
+			if(i == src->audioStream || i == src->videoStream)
+				avcodec_close(src->pFormatCtx->streams[i]->codec);
+		}
+		avformat_close_input(&src->pFormatCtx);
+	}
+	frame_pool_uninit(&src->video_pool);
+	av_frame_free(&src->primed_frame);
+	packet_queue_destroy(&src->audioq);
+	packet_queue_destroy(&src->videoq);
+	av_free(src);
+}
+
+/* open a playlist item: demuxer, stream info and both decoders */
+static MediaSource *source_open(VideoState *is, const char *filename) {
+
+	MediaSource *src;
+	AVFormatContext *pFormatCtx;
+	AVDictionary *format_opts = NULL;
+	const PlayerConfig *cfg = &is->engine->cfg;
+	int i;
+
+	src = av_mallocz(sizeof(MediaSource));
+	if(!src) return NULL;
+	av_strlcpy(src->filename, filename, sizeof(src->filename));
+	src->videoStream = src->audioStream = -1;
+	packet_queue_init(&src->audioq);
+	packet_queue_init(&src->videoq);
+	src->video_pool.usage = &is->mem_frames;
+
+	// will interrupt blocking functions if we quit!
+	pFormatCtx = avformat_alloc_context();
+	pFormatCtx->interrupt_callback.callback = decode_interrupt_cb;
+	pFormatCtx->interrupt_callback.opaque = is;
+
+	// Probe limits
+	if(cfg->fast_start) {
+		av_dict_set(&format_opts, "probesize", AV_STRINGIFY(FAST_PROBE_SIZE), 0);
+		av_dict_set(&format_opts, "analyzeduration", AV_STRINGIFY(FAST_ANALYZE_DURATION), 0);
+	}
+	else {
+		char value[32];
+		if(cfg->probe_size) {
+			snprintf(value, sizeof(value), "%"PRId64, cfg->probe_size);
+			av_dict_set(&format_opts, "probesize", value, 0);
+		}
+		if(cfg->analyze_duration) {
+			snprintf(value, sizeof(value), "%"PRId64, cfg->analyze_duration);
+			av_dict_set(&format_opts, "analyzeduration", value, 0);
+		}
+	}
+
+	// A live source is played as it comes, without buffering in the demuxer
+	if(cfg->live) {
+		av_dict_set(&format_opts, "fflags", "nobuffer", 0);
+		if(av_strstart(filename, "udp:", NULL))
+			av_dict_set(&format_opts, "overrun_nonfatal", "1", 0);
+	}
+
+	// Open video file
+	i = avformat_open_input(&pFormatCtx, filename, NULL, &format_opts);
+	av_dict_free(&format_opts);
+	if(i!=0) {
+		fprintf(stderr, "Unable to open %s\n", filename);
+		source_free(src);
+		return NULL;
+	}
+	src->pFormatCtx = pFormatCtx;
+
+	// Retrieve stream information (cached for files we have seen)
+	if(source_probe(pFormatCtx, filename, cfg)<0) {
+		fprintf(stderr, "%s: could not find stream information\n", filename);
+		source_free(src);
+		return NULL;
+	}
+
+	// Dump information about file onto standard error
+	av_dump_format(pFormatCtx, 0, filename, 0);
+
+	// Find the first video and audio streams
+	for(i=0; i<pFormatCtx->nb_streams; i++) {
+		if(pFormatCtx->streams[i]->codec->codec_type==AVMEDIA_TYPE_VIDEO && src->videoStream < 0)
+			src->videoStream=i;
+		if(pFormatCtx->streams[i]->codec->codec_type==AVMEDIA_TYPE_AUDIO && src->audioStream < 0)
+			src->audioStream=i;
+	}
+	/* a playlist item without sound plays silence (audio_silent); the
+	   first item of a channel needs it, for the audio device */
+	if(src->videoStream < 0 ||
+			(src->audioStream >= 0 && stream_open_codec(pFormatCtx->streams[src->audioStream]->codec) < 0) ||
+			stream_open_codec(pFormatCtx->streams[src->videoStream]->codec) < 0) {
+		fprintf(stderr, "%s: could not open codecs\n", filename);
+		source_free(src);
+		return NULL;
+	}
+	pFormatCtx->streams[src->videoStream]->codec->opaque = &src->video_pool;
+	if(src->audioStream >= 0)
+		src->audioq.time_base = pFormatCtx->streams[src->audioStream]->time_base;
+	src->videoq.time_base = pFormatCtx->streams[src->videoStream]->time_base;
+	if(pFormatCtx->start_time != AV_NOPTS_VALUE)
+		src->end_pts = pFormatCtx->start_time / (double)AV_TIME_BASE;
+	return src;
+}
+
+/* Decode the first video frame of an item ahead of time. Packets read on
+   the way are kept in the item's own queues and handed to the player when
+   it switches over; the decoder keeps its state so decoding continues
+   with the packet that follows the primed frame. */
+static int source_prime(MediaSource *src) {
+
+	AVStream *st = src->pFormatCtx->streams[src->videoStream];
+	AVPacket packet;
+	AVFrame *frame;
+	int got_frame = 0;
+	int64_t ts, dts = AV_NOPTS_VALUE;
+
+	frame = frame_alloc();
+	if(!frame) return -1;
+	while(!got_frame && av_read_frame(src->pFormatCtx, &packet) >= 0) {
+		if(packet.stream_index == src->videoStream) {
+			source_track_end(src, &packet);
+			dts = packet.dts;
+			avcodec_decode_video2(st->codec, frame, &got_frame, &packet);
+			av_free_packet(&packet);
+		}
+		else
+			source_queue_packet(src, &packet, &src->audioq, &src->videoq);
+	}
+	if(got_frame) {
+		/* as the video thread would have it (video_frame_pts) */
+		ts = video_frame_ts(dts, frame);
+		src->primed_pts = ts == AV_NOPTS_VALUE ? 0 : ts * av_q2d(st->time_base);
+		src->primed_frame = frame;
+	}
+	else
+		av_frame_free(&frame);
+	src->ready_time = av_gettime();
+	return got_frame ? 0 : -1;
+}
+
+static int playlist_add(Playlist *pl, const char *item) {
+
+	if(pl->nb_items >= MAX_PLAYLIST_SIZE)
+		return -1;
+	if(!pl->items)
+		pl->items = av_mallocz(MAX_PLAYLIST_SIZE * sizeof(char *));
+	pl->items[pl->nb_items++] = av_strdup(item);
+	return 0;
+}
+
+static int compare_names(const void *a, const void *b) {
+
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* A channel plays either a single media file, every regular file of a
+   directory (sorted by name) or the entries of a .m3u/.txt playlist,
+   relative paths being taken from the playlist's directory. */
+int playlist_load(Playlist *pl, const char *path) {
+
+	struct stat buffer;
+	char line[2048], item[2048];
+	const char *slash;
+	struct dirent *entry;
+	DIR *dir;
+	FILE *f;
+	int first, len;
+
+	if(!stat(path, &buffer) && S_ISDIR(buffer.st_mode)) {
+		if(!(dir = opendir(path)))
+			return -1;
+		first = pl->nb_items;
+		while((entry = readdir(dir))) {
+			if(entry->d_name[0] == '.')
+				continue;
+			snprintf(item, sizeof(item), "%s/%s", path, entry->d_name);
+			if(!stat(item, &buffer) && S_ISREG(buffer.st_mode))
+				playlist_add(pl, item);
+		}
+		closedir(dir);
+		qsort(pl->items + first, pl->nb_items - first, sizeof(char *), compare_names);
+	}
+	else if(!strstr(path, "://") && av_match_ext(path, "m3u,m3u8,txt,lst")) {
+		if(!(f = fopen(path, "r")))
+			return -1;
+		slash = strrchr(path, '/');
+		while(fgets(line, sizeof(line), f)) {
+			len = strlen(line);
+			while(len > 0 && (line[len-1] == '\n' || line[len-1] == '\r' || line[len-1] == ' '))
+				line[--len] = 0;
+			if(!len || line[0] == '#')
+				continue;
+			if(line[0] != '/' && !strstr(line, "://") && slash)
+				snprintf(item, sizeof(item), "%.*s/%s", (int)(slash - path), path, line);
+			else
+				av_strlcpy(item, line, sizeof(item));
+			playlist_add(pl, item);
+		}
+		fclose(f);
+	}
+	else
+		playlist_add(pl, path);
+	return pl->nb_items > 0 ? 0 : -1;
+}
+
+/* Background thread of a channel with a playlist: opens, probes and primes
+   the next item while the current one plays, and closes finished items
+   away from the decoding threads. */
+int playlist_thread(void *arg) {
+
+	VideoState *is = (VideoState *)arg;
+	MediaSource *src, *retired;
+	int tries;
+
+	SDL_LockMutex(is->read_mutex);
+	for(;;) {
+		while(!is->quit && !is->preload_req && !is->retired) {
+			SDL_CondWait(is->preload_cond, is->read_mutex);
+		}
+		if(is->quit) break;
+
+		if(is->retired) {
+			retired = is->retired;
+			is->retired = NULL;
+			SDL_UnlockMutex(is->read_mutex);
+			while(retired) {
+				src = retired;
+				retired = retired->retired_next;
+				source_free(src);
+			}
+			SDL_LockMutex(is->read_mutex);
+			continue;
+		}
+
+		is->preload_req = 0;
+		SDL_UnlockMutex(is->read_mutex);
+		src = NULL;
+		for(tries = 0; tries < is->playlist.nb_items && !src && !is->quit; tries++) {
+			const char *filename = is->playlist.items[is->playlist.next];
+			if(is->engine->headless && is->playlist.next == 0)
+				break;	/* exports and verifications go through the playlist once */
+			is->playlist.next = (is->playlist.next + 1) % is->playlist.nb_items;
+			src = source_open(is, filename);
+			if(src && source_prime(src) < 0) {
+				fprintf(stderr, "%s: no video frame, skipping\n", filename);
+				source_free(src);
+				src = NULL;
+			}
+		}
+		SDL_LockMutex(is->read_mutex);
+		is->preloaded = src;
+		is->preload_done = 1;
+		/* its packets count against the budget until they join the queues */
+		is->preload_bytes = src ? src->audioq.size + src->videoq.size : 0;
+		mem_charge(&is->mem_cache, is->preload_bytes);
+		SDL_CondSignal(is->read_cond);
+	}
+	SDL_UnlockMutex(is->read_mutex);
+	return 0;
+}
+
+/* The demuxer reached the end of the current item: continue with the
+   preloaded one. A switch marker in each queue tells the decoders where the
+   boundary is, so playback moves on at the next frame without a flush. */
+static int stream_next_item(VideoState *is) {
+
+	MediaSource *old = is->src, *next;
+	AVFormatContext *pFormatCtx;
+	AVPacket packet;
+	double start;
+
+	SDL_LockMutex(is->read_mutex);
+	while(!is->preload_done && !is->quit && !is->seek_req) {
+		SDL_CondWait(is->read_cond, is->read_mutex);
+	}
+	if(!is->preload_done) {
+		SDL_UnlockMutex(is->read_mutex);
+		return -1;
+	}
+	next = is->preloaded;
+	is->preloaded = NULL;
+	is->preload_done = 0;
+	mem_charge(&is->mem_cache, -is->preload_bytes);
+	is->preload_bytes = 0;
+	if(next) {
+		/* start on the item after it */
+		is->preload_req = 1;
+		SDL_CondSignal(is->preload_cond);
+	}
+	SDL_UnlockMutex(is->read_mutex);
+	if(!next)
+		return -1;
+
+	pFormatCtx = next->pFormatCtx;
+	start = pFormatCtx->start_time != AV_NOPTS_VALUE ? pFormatCtx->start_time / (double)AV_TIME_BASE : 0;
+	next->pts_offset = old->pts_offset + old->end_pts - start;
+	next->serial = is->seek_serial;
+	next->refcount = 3;	/* demuxer, audio and video decoders */
+	old->next = next;
+	fprintf(stderr, "Channel %d: next item %s (primed %.1f ms ahead)\n",
+			is->is_small ? 2 : 1, next->filename, (av_gettime() - next->ready_time) / 1000.0);
+
+	packet_queue_put(&is->videoq, &switch_pkt);
+	packet_queue_put(&is->audioq, &switch_pkt);
+	while(packet_queue_get(&next->videoq, &packet, 0) > 0) {
+		packet.duration = av_rescale_q(packet.duration, next->videoq.time_base, is->videoq.time_base);
+		packet_queue_put(&is->videoq, &packet);
+	}
+	while(packet_queue_get(&next->audioq, &packet, 0) > 0) {
+		packet.duration = av_rescale_q(packet.duration, next->audioq.time_base, is->audioq.time_base);
+		packet_queue_put(&is->audioq, &packet);
+	}
+
+	is->src = next;
+	is->pFormatCtx = pFormatCtx;
+	channel_set_byte_rate(is, next);
+	is->videoStream = next->videoStream;
+	is->audioStream = next->audioStream;
+	av_strlcpy(is->filename, next->filename, sizeof(is->filename));
+	source_release(is, old);
+	return 0;
+}
+
+static void loop_cache_free(VideoState *is) {
+
+	LoopCache *loop = &is->loop;
+	int i;
+
+	mem_charge(&is->mem_cache, -loop->bytes);
+	for(i = 0; i < loop->nb_pkts; i++)
+		av_free_packet(&loop->pkts[i]);
+	av_freep(&loop->pkts);
+	memset(loop, 0, sizeof(*loop));
+}
+
+/* demuxer: back to A, to the keyframe before it */
+static void loop_seek(VideoState *is) {
+
+	is->loop.state = LOOP_SEEKING;
+	is->loop.past_b[0] = is->audioStream < 0;	/* no sound to read up to B */
+	is->loop.past_b[1] = 0;
+	is->seek_pos = (int64_t)(is->loop_a * AV_TIME_BASE);
+	is->seek_flags = AVSEEK_FLAG_BACKWARD;
+	is->seek_req = 1;
+}
+
+/* demuxer: the loop points changed, a new loop starts with a seek to A */
+static void loop_apply(VideoState *is) {
+
+	SDL_LockMutex(is->read_mutex);
+	is->loop_req = 0;
+	SDL_UnlockMutex(is->read_mutex);
+	loop_cache_free(is);
+	if(is->loop_b > 0)
+		loop_seek(is);
+}
+
+/* demuxer: read up to B, the repeats begin */
+static void loop_wrap(VideoState *is) {
+
+	LoopCache *loop = &is->loop;
+
+	if(loop->nocache || !loop->nb_pkts) {
+		loop_seek(is);
+		return;
+	}
+	if(loop->state == LOOP_RECORDING)
+		fprintf(stderr, "Channel %d: loop %.2f - %.2f kept, %d packets (%.1f MB)\n",
+				is->is_small ? 2 : 1, is->loop_a, is->loop_b, loop->nb_pkts, loop->bytes / 1048576.0);
+	loop->state = LOOP_REPLAY;
+	loop->pos = 0;
+	packet_queue_put(&is->videoq, &loop_pkt);
+}
+
+/* First pass through the loop: keep a copy of what is read up to B. A
+   stream read past B is done with; once both are, the repeats begin.
+   Returns 0 when the packet was dropped. */
+static int loop_record(VideoState *is, AVPacket *packet) {
+
+	LoopCache *loop = &is->loop;
+	AVPacket *pkts;
+	int s, alloc;
+
+	if(packet->stream_index == is->audioStream) s = 0;
+	else if(packet->stream_index == is->videoStream) s = 1;
+	else return 1;
+	if(!loop->past_b[s] && packet_time(is->pFormatCtx->streams[packet->stream_index], is->src, packet) > is->loop_b)
+		loop->past_b[s] = 1;
+	if(loop->past_b[s]) {
+		av_free_packet(packet);
+		if(loop->past_b[!s])
+			loop_wrap(is);
+		return 0;
+	}
+	if(loop->nocache)
+		return 1;
+	if(loop->nb_pkts == loop->alloc) {
+		alloc = FFMAX(256, 2 * loop->alloc);
+		pkts = av_realloc(loop->pkts, alloc * sizeof(*pkts));
+		if(pkts) {
+			loop->pkts = pkts;
+			loop->alloc = alloc;
+		}
+	}
+	if(loop->nb_pkts == loop->alloc || !loop_fits(is, packet->size) ||
+			av_copy_packet(&loop->pkts[loop->nb_pkts], packet) < 0) {
+		fprintf(stderr, "Channel %d: the loop does not fit in %"PRId64" MB, every repeat seeks\n",
+				is->is_small ? 2 : 1, (mem_budget.budget ? mem_budget.budget : LOOP_MAX_SIZE) >> 20);
+		while(loop->nb_pkts)
+			av_free_packet(&loop->pkts[--loop->nb_pkts]);
+		av_freep(&loop->pkts);
+		loop->alloc = 0;
+		mem_charge(&is->mem_cache, -loop->bytes);
+		loop->bytes = 0;
+		loop->nocache = 1;
+		return 1;
+	}
+	loop->nb_pkts++;
+	loop->bytes += packet->size;
+	mem_charge(&is->mem_cache, packet->size);
+	return 1;
+}
+
+/* a repeat: queue the next kept packet, no demuxing */
+static void loop_replay(VideoState *is) {
+
+	LoopCache *loop = &is->loop;
+	AVPacket *cached = &loop->pkts[loop->pos], packet;
+	AVStream *st = is->pFormatCtx->streams[cached->stream_index];
+	double end;
+
+	/* the sound from the keyframe to A is not heard */
+	end = (cached->pts + cached->duration) * av_q2d(st->time_base) + is->src->pts_offset;
+	if((cached->stream_index != is->audioStream || cached->pts == AV_NOPTS_VALUE || end > is->loop_a) &&
+			av_copy_packet(&packet, cached) == 0)
+		source_queue_packet(is->src, &packet, &is->audioq, &is->videoq);
+	if(++loop->pos == loop->nb_pkts) {
+		loop->pos = 0;
+		packet_queue_put(&is->videoq, &loop_pkt);
+	}
+}
+
+int decode_thread(void *arg) {
+
+	VideoState *is = (VideoState *)arg;
+	AVPacket pkt1, *packet = &pkt1;
+	MediaSource *src;
+	int ret;
+
+	is->videoStream= is->audioStream=-1;
+
+	// Open the first item of the channel
+	src = source_open(is, is->filename);
+	if(!src)
+		goto fail;
+	src->refcount = 3;	/* demuxer, audio and video decoders */
+	is->src = is->audio_src = is->video_src = src;
+	is->pFormatCtx = src->pFormatCtx;
+	channel_set_byte_rate(is, src);
+
+	stream_component_open(is, src->audioStream);
+	stream_component_open(is, src->videoStream);
+
+	if(is->videoStream < 0 || is->audioStream < 0) {
+		fprintf(stderr, "%s: could not open codecs\n", is->filename);
+		goto fail;
+	}
+	is->open_time = av_gettime();
+	SDL_LockMutex(is->read_mutex);
+	is->opened = 1;
+	SDL_CondBroadcast(is->read_cond);
+	SDL_UnlockMutex(is->read_mutex);
+
+	if(is->playlist.nb_items > 1) {
+		is->playlist.next = 1;
+		is->preload_req = 1;
+		is->playlist_tid = SDL_CreateThread(playlist_thread, is);
+	}
+
+	// main decode loop
+
+	for(;;) {
+		if(is->quit) break;
+		if(is->loop_req)
+			loop_apply(is);
+		// seek stuff goes here
+		if(is->seek_req) {
+			int stream_index= -1, switches;
+			/* seek_pos is on the playlist timeline, the demuxer on the item's own */
+			int64_t seek_target = is->seek_pos - (int64_t)(is->src->pts_offset * AV_TIME_BASE);
+
+			if     (is->videoStream >= 0) stream_index = is->videoStream;
+			else if(is->audioStream >= 0) stream_index = is->audioStream;
+
+			if(stream_index>=0)
+				seek_target= av_rescale_q(seek_target, AV_TIME_BASE_Q, is->pFormatCtx->streams[stream_index]->time_base);
+			if(av_seek_frame(is->pFormatCtx, stream_index, seek_target, is->seek_flags) < 0) {
+				fprintf(stderr, "%s: error while seeking\n", is->pFormatCtx->filename);
+				if(is->loop.state == LOOP_SEEKING) {
+					loop_cache_free(is);
+					is->loop_b = 0;
+				}
+			}
+			else {
+				if(is->loop.state == LOOP_SEEKING)
+					is->loop.state = LOOP_RECORDING;
+				/* pending switch markers go back in front of the flush so the
+				   decoders still move on to the item we are reading */
+				is->seek_serial++;
+				if(is->audioStream >= 0) {
+					switches = packet_queue_flush(&is->audioq);
+					while(switches--)
+						packet_queue_put(&is->audioq, &switch_pkt);
+					packet_queue_put(&is->audioq, &flush_pkt);
+				}
+				if(is->videoStream >= 0) {
+					switches = packet_queue_flush(&is->videoq);
+					while(switches--)
+						packet_queue_put(&is->videoq, &switch_pkt);
+					packet_queue_put(&is->videoq, &flush_pkt);
+				}
+			}
+			if(is->sync_seek) {
+				/* lock mode: pictures from here on are from after the seek,
+				   the same ones as before it when the seek failed */
+				is->sync_serial = is->seek_serial;
+				is->sync_seek = 0;
+			}
+			is->seek_req = 0;
+		}
+
+		/* queues are full: sleep until the consumers drain them below
+		   the low-water mark instead of polling */
+		if(stream_queues_full(is, MAX_QUEUE_DURATION)) {
+			SDL_LockMutex(is->read_mutex);
+			is->read_waiting = 1;
+			while(!is->quit && !is->seek_req && !is->loop_req && stream_queues_full(is, MIN_QUEUE_DURATION)) {
+				SDL_CondWait(is->read_cond, is->read_mutex);
+			}
+			is->read_waiting = 0;
+			SDL_UnlockMutex(is->read_mutex);
+			continue;
+		}
+		if(is->loop.state == LOOP_REPLAY) {
+			loop_replay(is);
+			continue;
+		}
+		if((ret = av_read_frame(is->pFormatCtx, packet)) < 0) {
+			if(ret == AVERROR_EOF || (is->pFormatCtx->pb && is->pFormatCtx->pb->eof_reached)) {
+				/* B is past the end: the loop ends there */
+				if(is->loop.state == LOOP_RECORDING) {
+					loop_wrap(is);
+					continue;
+				}
+				if(is->playlist.nb_items > 1 && stream_next_item(is) == 0)
+					continue;
+				if(is->engine->headless) {
+					packet_queue_put(&is->videoq, &eof_pkt);
+					packet_queue_put(&is->audioq, &eof_pkt);
+				}
+				/* end of file; wait for the user to seek, loop or quit */
+				SDL_LockMutex(is->read_mutex);
+				while(!is->quit && !is->seek_req && !is->loop_req) {
+					SDL_CondWait(is->read_cond, is->read_mutex);
+				}
+				SDL_UnlockMutex(is->read_mutex);
+				continue;
+			}
+			if(!is->pFormatCtx->pb || is->pFormatCtx->pb->error == 0) {
+				SDL_Delay(10); /* transient error (EAGAIN); retry */
+				continue;
+			}
+			else break;
+		}
+		if(is->loop.state == LOOP_RECORDING && !loop_record(is, packet))
+			continue;
+		source_queue_packet(is->src, packet, &is->audioq, &is->videoq);
+	}
+	/* all done - wait for it */
+	SDL_LockMutex(is->read_mutex);
+	while(!is->quit) {
+		SDL_CondWait(is->read_cond, is->read_mutex);
+	}
+	SDL_UnlockMutex(is->read_mutex);
+	fail:
+	SDL_LockMutex(is->read_mutex);
+	if(!is->opened)
+		is->opened = -1;
+	SDL_CondBroadcast(is->read_cond);
+	SDL_UnlockMutex(is->read_mutex);
+	{
+		SDL_Event event;
+		event.type = FF_QUIT_EVENT;
+		event.user.data1 = is;
+		SDL_PushEvent(&event);
+	}
+	return 0;
+}
+
+void stream_seek(VideoState *is, int64_t pos, int rel) {
+
+	if(!is->seek_req) {
+		is->seek_pos = pos;
+		is->seek_flags = rel < 0 ? AVSEEK_FLAG_BACKWARD : 0;
+		is->seek_req = 1;
+		demux_signal(is);
+	}
+}
+
+/* hand a frame to the encoder thread, waiting for room in the queue; the
+   reference moves to the queue and 'frame' is left empty */
+static void exporter_put(Exporter *ex, AVFrame *frame) {
+
+	pthread_mutex_lock(&ex->mutex);
+	while(ex->queue_size >= EXPORT_QUEUE_SIZE) {
+		pthread_cond_wait(&ex->cond, &ex->mutex);
+	}
+	av_frame_move_ref(ex->queue[ex->windex], frame);
+	if(++ex->windex == EXPORT_QUEUE_SIZE)
+		ex->windex = 0;
+	ex->queue_size++;
+	pthread_cond_broadcast(&ex->cond);
+	pthread_mutex_unlock(&ex->mutex);
+}
+
+/* encode one frame (NULL flushes the encoder) and mux what comes out;
+   returns 1 when a packet was written */
+static int exporter_encode(Exporter *ex, AVStream *st, AVFrame *frame) {
+
+	AVPacket pkt;
+	int got_packet = 0, ret;
+
+	av_init_packet(&pkt);
+	pkt.data = NULL;
+	pkt.size = 0;
+	if(st == ex->video_st)
+		ret = avcodec_encode_video2(st->codec, &pkt, frame, &got_packet);
+	else
+		ret = avcodec_encode_audio2(st->codec, &pkt, frame, &got_packet);
+	if(ret < 0) {
+		fprintf(stderr, "Export: error while encoding\n");
+		return ret;
+	}
+	if(!got_packet)
+		return 0;
+	pkt.stream_index = st->index;
+	if(pkt.pts != AV_NOPTS_VALUE)
+		pkt.pts = av_rescale_q(pkt.pts, st->codec->time_base, st->time_base);
+	if(pkt.dts != AV_NOPTS_VALUE)
+		pkt.dts = av_rescale_q(pkt.dts, st->codec->time_base, st->time_base);
+	pkt.duration = av_rescale_q(pkt.duration, st->codec->time_base, st->time_base);
+	if((ret = av_interleaved_write_frame(ex->oc, &pkt)) < 0) {
+		fprintf(stderr, "Export: error while writing %s\n", ex->oc->filename);
+		return ret;
+	}
+	return 1;
+}
+
+/* encoder thread: runs behind the producers until they are done, then
+   drains the encoders and finishes the file */
+static void *exporter_thread(void *arg) {
+
+	Exporter *ex = arg;
+	AVFrame *frame = av_frame_alloc();
+
+	pthread_mutex_lock(&ex->mutex);
+	for(;;) {
+		while(!ex->queue_size && !ex->eof) {
+			pthread_cond_wait(&ex->cond, &ex->mutex);
+		}
+		if(!ex->queue_size)
+			break;
+		av_frame_move_ref(frame, ex->queue[ex->rindex]);
+		if(++ex->rindex == EXPORT_QUEUE_SIZE)
+			ex->rindex = 0;
+		ex->queue_size--;
+		pthread_cond_broadcast(&ex->cond);
+		pthread_mutex_unlock(&ex->mutex);
+
+		exporter_encode(ex, frame->nb_samples ? ex->audio_st : ex->video_st, frame);
+		av_frame_unref(frame);
+
+		pthread_mutex_lock(&ex->mutex);
+	}
+	pthread_mutex_unlock(&ex->mutex);
+
+	while(exporter_encode(ex, ex->video_st, NULL) > 0);
+	while(ex->audio_st && exporter_encode(ex, ex->audio_st, NULL) > 0);
+	av_write_trailer(ex->oc);
+	av_frame_free(&frame);
+	return NULL;
+}
+
+static AVStream *exporter_add_stream(Exporter *ex, enum AVCodecID codec_id, AVCodec **codec) {
+
+	AVStream *st;
+
+	*codec = avcodec_find_encoder(codec_id);
+	if(!*codec) {
+		fprintf(stderr, "Export: no encoder for the %s format\n", ex->oc->oformat->name);
+		return NULL;
+	}
+	st = avformat_new_stream(ex->oc, *codec);
+	if(!st) return NULL;
+	if(ex->oc->oformat->flags & AVFMT_GLOBALHEADER)
+		st->codec->flags |= CODEC_FLAG_GLOBAL_HEADER;
+	return st;
+}
+
+static int exporter_open_video(Exporter *ex, const PlayerConfig *cfg) {
+
+	AVCodec *codec;
+	AVCodecContext *c;
+	const enum AVPixelFormat *fmt;
+
+	if(!(ex->video_st = exporter_add_stream(ex, ex->oc->oformat->video_codec, &codec)))
+		return -1;
+	c = ex->video_st->codec;
+	for(fmt = codec->pix_fmts; fmt && *fmt != AV_PIX_FMT_NONE && *fmt != AV_PIX_FMT_YUV420P; fmt++);
+	if(fmt && *fmt != AV_PIX_FMT_YUV420P) {
+		fprintf(stderr, "Export: %s does not take YUV420P pictures\n", codec->name);
+		return -1;
+	}
+	c->pix_fmt = AV_PIX_FMT_YUV420P;
+	c->width = ex->width;
+	c->height = ex->height;
+	c->time_base = av_inv_q(ex->frame_rate);
+	ex->video_st->time_base = c->time_base;
+	/* about 0.15 bit per pixel, fine for the usual 4:2:0 codecs */
+	c->bit_rate = (int64_t)(ex->width * ex->height * av_q2d(ex->frame_rate) * 0.15);
+	c->thread_count = cfg->encoder_threads;	// 0: one per core
+	if(cfg->encoder_preset && av_opt_set(c->priv_data, "preset", cfg->encoder_preset, 0) < 0)
+		fprintf(stderr, "Export: %s has no preset %s, using its defaults\n", codec->name, cfg->encoder_preset);
+	if(avcodec_open2(c, codec, NULL) < 0) {
+		fprintf(stderr, "Export: could not open the %s encoder\n", codec->name);
+		return -1;
+	}
+	return 0;
+}
+
+static int exporter_open_audio(Exporter *ex, int sample_rate, int channels) {
+
+	AVCodec *codec;
+	AVCodecContext *c;
+	const int *rate;
+
+	if(!(ex->audio_st = exporter_add_stream(ex, ex->oc->oformat->audio_codec, &codec)))
+		return -1;
+	c = ex->audio_st->codec;
+	c->sample_fmt = codec->sample_fmts ? codec->sample_fmts[0] : AV_SAMPLE_FMT_S16;
+	c->sample_rate = sample_rate;
+	if(codec->supported_samplerates) {
+		for(rate = codec->supported_samplerates; *rate && *rate != sample_rate; rate++);
+		if(!*rate)
+			c->sample_rate = codec->supported_samplerates[0];
+	}
+	c->channels = channels;
+	c->channel_layout = av_get_default_channel_layout(c->channels);
+	c->bit_rate = 64000 * FFMIN(c->channels, 2);
+	c->time_base = (AVRational){ 1, c->sample_rate };
+	ex->audio_st->time_base = c->time_base;
+	c->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;	// the native AAC encoder
+	if(avcodec_open2(c, codec, NULL) < 0) {
+		fprintf(stderr, "Export: could not open the %s encoder\n", codec->name);
+		return -1;
+	}
+	ex->variable_frame_size = (codec->capabilities & CODEC_CAP_VARIABLE_FRAME_SIZE) || !c->frame_size;
+	ex->audio_frame_size = c->frame_size ? c->frame_size : 1024;
+	ex->fifo = av_audio_fifo_alloc(c->sample_fmt, c->channels, ex->audio_frame_size);
+	ex->audio_frame = av_frame_alloc();
+	ex->audio_next_pts = AV_NOPTS_VALUE;
+	if(!ex->fifo || !ex->audio_frame)
+		return -1;
+	return 0;
+}
+
+void exporter_free(Exporter *ex) {
+
+	int i;
+
+	if(!ex) return;
+	if(ex->oc) {
+		for(i = 0; i < ex->oc->nb_streams; i++)
+			avcodec_close(ex->oc->streams[i]->codec);
+		if(ex->oc->pb && !(ex->oc->oformat->flags & AVFMT_NOFILE))
+			avio_close(ex->oc->pb);
+		avformat_free_context(ex->oc);
+	}
+	for(i = 0; i < EXPORT_QUEUE_SIZE; i++)
+		av_frame_free(&ex->queue[i]);
+	for(i = 0; i < 2; i++)
+		sws_freeContext(ex->tile_sws[i]);
+	frame_pool_uninit(&ex->canvas_pool);
+	swr_free(&ex->swr);
+	if(ex->conv)
+		av_freep(&ex->conv[0]);
+	av_freep(&ex->conv);
+	if(ex->fifo)
+		av_audio_fifo_free(ex->fifo);
+	av_frame_free(&ex->audio_frame);
+	pthread_mutex_destroy(&ex->mutex);
+	pthread_cond_destroy(&ex->cond);
+	av_free(ex);
+}
+
+/* Create the output file with a video stream of 'width' x 'height' at
+   'frame_rate' and, unless 'sample_rate' is 0, an audio stream; the
+   codecs are the defaults of the container. */
+Exporter *exporter_open(const char *filename, int width, int height, AVRational frame_rate, int sample_rate, int channels,
+		const PlayerConfig *cfg) {
+
+	Exporter *ex = av_mallocz(sizeof(Exporter));
+	int i;
+
+	if(!ex) return NULL;
+	pthread_mutex_init(&ex->mutex, NULL);
+	pthread_cond_init(&ex->cond, NULL);
+	for(i = 0; i < EXPORT_QUEUE_SIZE; i++) {
+		if(!(ex->queue[i] = frame_alloc()))
+			goto fail;
+	}
+	ex->width = width & ~1;
+	ex->height = height & ~1;
+	ex->frame_rate = frame_rate;
+
+	avformat_alloc_output_context2(&ex->oc, NULL, NULL, filename);
+	if(!ex->oc) {
+		fprintf(stderr, "Export: could not find an output format for %s\n", filename);
+		goto fail;
+	}
+	if(exporter_open_video(ex, cfg) < 0)
+		goto fail;
+	if(sample_rate && ex->oc->oformat->audio_codec != AV_CODEC_ID_NONE && exporter_open_audio(ex, sample_rate, channels) < 0)
+		goto fail;
+	av_dump_format(ex->oc, 0, filename, 1);
+	if(!(ex->oc->oformat->flags & AVFMT_NOFILE) && avio_open(&ex->oc->pb, filename, AVIO_FLAG_WRITE) < 0) {
+		fprintf(stderr, "Export: could not open %s\n", filename);
+		goto fail;
+	}
+	if(avformat_write_header(ex->oc, NULL) < 0) {
+		fprintf(stderr, "Export: could not write the header of %s\n", filename);
+		goto fail;
+	}
+	if(pthread_create(&ex->thread, NULL, exporter_thread, ex)) {
+		fprintf(stderr, "Export: could not start the encoder thread\n");
+		goto fail;
+	}
+	return ex;
+
+fail:
+	exporter_free(ex);
+	return NULL;
+}
+
+/* the producers are done: let the encoder thread drain and finish the file */
+void exporter_close(Exporter *ex) {
+
+	pthread_mutex_lock(&ex->mutex);
+	ex->eof = 1;
+	pthread_cond_broadcast(&ex->cond);
+	pthread_mutex_unlock(&ex->mutex);
+	pthread_join(ex->thread, NULL);
+	exporter_free(ex);
+}
+
+/* cut the fifo in encoder frames; 'final' also sends what is left */
+static int exporter_cut_audio(Exporter *ex, int final) {
+
+	AVCodecContext *c = ex->audio_st->codec;
+	AVFrame *frame = ex->audio_frame;
+	int n;
+
+	while(av_audio_fifo_size(ex->fifo) >= ex->audio_frame_size || (final && av_audio_fifo_size(ex->fifo) > 0)) {
+		n = FFMIN(av_audio_fifo_size(ex->fifo), ex->audio_frame_size);
+		frame->nb_samples = ex->variable_frame_size ? n : ex->audio_frame_size;
+		frame->format = c->sample_fmt;
+		frame->channel_layout = c->channel_layout;
+		frame->sample_rate = c->sample_rate;
+		if(av_frame_get_buffer(frame, 0) < 0)
+			return -1;
+		if(n < frame->nb_samples)	// last frame of a fixed size encoder
+			av_samples_set_silence(frame->data, n, frame->nb_samples - n, c->channels, c->sample_fmt);
+		av_audio_fifo_read(ex->fifo, (void **)frame->data, n);
+		frame->pts = ex->audio_next_pts;
+		ex->audio_next_pts += n;
+		exporter_put(ex, frame);
+	}
+	return 0;
+}
+
+/* Queue 'nb_samples' of interleaved S16 audio starting 'pts' seconds into
+   the file; only the first pts is used, the rest follows on from it. */
+int exporter_put_audio(Exporter *ex, const uint8_t *samples, int nb_samples, int rate, int channels, double pts) {
+
+	AVCodecContext *c = ex->audio_st->codec;
+	int out;
+
+	if(!ex->swr || rate != ex->swr_rate || channels != ex->swr_channels) {
+		/* playlist items may differ in rate and channels */
+		swr_free(&ex->swr);
+		ex->swr = swr_alloc_set_opts(NULL, c->channel_layout, c->sample_fmt, c->sample_rate,
+				av_get_default_channel_layout(channels), AV_SAMPLE_FMT_S16, rate, 0, NULL);
+		if(!ex->swr || swr_init(ex->swr) < 0) {
+			fprintf(stderr, "Export: could not convert %d Hz %d channel audio\n", rate, channels);
+			swr_free(&ex->swr);
+			return -1;
+		}
+		ex->swr_rate = rate;
+		ex->swr_channels = channels;
+	}
+	if(ex->audio_next_pts == AV_NOPTS_VALUE)
+		ex->audio_next_pts = pts > 0 ? llrint(pts * c->sample_rate) : 0;
+
+	out = av_rescale_rnd(swr_get_delay(ex->swr, rate) + nb_samples, c->sample_rate, rate, AV_ROUND_UP);
+	if(out > ex->conv_samples) {
+		if(ex->conv)
+			av_freep(&ex->conv[0]);
+		av_freep(&ex->conv);
+		if(av_samples_alloc_array_and_samples(&ex->conv, NULL, c->channels, out, c->sample_fmt, 0) < 0)
+			return -1;
+		ex->conv_samples = out;
+	}
+	out = swr_convert(ex->swr, ex->conv, out, &samples, nb_samples);
+	if(out < 0 || av_audio_fifo_write(ex->fifo, (void **)ex->conv, out) < out)
+		return -1;
+	return exporter_cut_audio(ex, 0);
+}
+
+/* Composite the pictures of both channels on a canvas the way
+   video_display lays them out on the screen. */
+static int exporter_composite(Exporter *ex, const Composition *comp, AVFrame *canvas) {
+
+	int c;
+
+	canvas->format = AV_PIX_FMT_YUV420P;
+	canvas->width = ex->width;
+	canvas->height = ex->height;
+	if(frame_pool_get(&ex->canvas_pool, canvas, ex->width, ex->height) < 0)
+		return -1;
+	memset(canvas->data[0], 16, canvas->linesize[0] * ex->height);
+	memset(canvas->data[1], 128, canvas->linesize[1] * ex->height / 2);
+	memset(canvas->data[2], 128, canvas->linesize[2] * ex->height / 2);
+
+	for(c = 0; c < 2; c++) {
+		if(!comp->pictures[c]->buf[0])
+			continue;
+		tile_draw(&ex->tile_sws[c], comp->pictures[c], &comp->rects[c], comp->color_flags[c],
+				canvas->data, canvas->linesize, ex->width, ex->height);
+	}
+	return 0;
+}
+
+/* Move the picture of 'is' that is on screen at 'target' (pts) into
+   'picture': pictures are taken from the queue as long as they are due.
+   Returns 1 once the channel ended. */
+static int export_channel_advance(VideoState *is, AVFrame *picture, double target) {
+
+	VideoPicture *vp;
+
+	for(;;) {
+		SDL_LockMutex(is->pictq_mutex);
+		while(is->pictq_size == 0 && !is->quit) {
+			SDL_CondWait(is->pictq_cond, is->pictq_mutex);
+		}
+		SDL_UnlockMutex(is->pictq_mutex);
+		if(is->quit)
+			return 1;
+
+		vp = &is->pictq[is->pictq_rindex];
+		if(vp->frame->buf[0] && picture->buf[0] && vp->pts > target)
+			return 0;
+		if(!vp->frame->buf[0]) {
+			/* end marker: stays in the queue, the channel is done */
+			return 1;
+		}
+		av_frame_unref(picture);
+		av_frame_move_ref(picture, vp->frame);
+		picture->pts = (int64_t)(vp->pts * AV_TIME_BASE);
+		if(++is->pictq_rindex == VIDEO_PICTURE_QUEUE_SIZE) {
+			is->pictq_rindex = 0;
+		}
+		SDL_LockMutex(is->pictq_mutex);
+		is->pictq_size--;
+		SDL_CondSignal(is->pictq_cond);
+		SDL_UnlockMutex(is->pictq_mutex);
+	}
+}
+
+/* export mode: audio of a channel. The exported channel's audio is decoded
+   and queued for the encoder, the other one is only kept moving so its
+   demuxer does not stall. */
+static void *export_audio_thread(void *arg) {
+
+	VideoState *is = arg;
+	AVCodecContext *c;
+	AVPacket pkt;
+	double pts;
+	int size;
+
+	if(!is->export_audio) {
+		while(packet_queue_get(&is->audioq, &pkt, 1) > 0) {
+			demux_wake(is);
+			if(pkt.data == eof_pkt.data)
+				break;
+			if(pkt.data == switch_pkt.data)
+				is->audio_src = source_advance(is, is->audio_src);
+			else if(pkt.data != flush_pkt.data)
+				av_free_packet(&pkt);
+		}
+		return NULL;
+	}
+	while((size = audio_decode_frame(is, &pts)) >= 0) {
+		c = is->audio_st->codec;
+		if(exporter_put_audio(is->engine->exporter, is->audio_buf, size / (2 * c->channels), c->sample_rate, c->channels,
+				pts - is->export_base) < 0)
+			break;
+	}
+	exporter_cut_audio(is->engine->exporter, 1);
+	return NULL;
+}
+
+/* wait for decode_thread to open the codecs of a channel */
+static int export_wait_opened(VideoState *is) {
+
+	SDL_LockMutex(is->read_mutex);
+	while(!is->opened) {
+		SDL_CondWait(is->read_cond, is->read_mutex);
+	}
+	SDL_UnlockMutex(is->read_mutex);
+	return is->opened > 0 ? 0 : -1;
+}
+
+/* Export mode: the channels decode and filter as fast as they can, their
+   pictures are composited at the frame rate of the primary channel and
+   encoded together with the audio of one of them. */
+int export_run(VideoState *is, int width, int height) {
+
+	PlayerEngine *e = is->engine;
+	VideoState *channels[2] = { is, is->is2 };
+	AVFrame **pictures, *canvas;
+	Composition comp;
+	AVStream *st;
+	AVRational frame_rate;
+	pthread_t audio_tid[2];
+	int64_t start = av_gettime();
+	int c, n, ended[2] = { 0, 0 };
+
+	for(c = 0; c < 2; c++) {
+		if(export_wait_opened(channels[c]) < 0)
+			return 1;
+	}
+	/* time 0 of the file is the first picture of each channel */
+	pictures = comp.pictures;
+	for(c = 0; c < 2; c++) {
+		pictures[c] = frame_alloc();
+		ended[c] = export_channel_advance(channels[c], pictures[c], 0);
+		channels[c]->export_base = pictures[c]->buf[0] ? pictures[c]->pts / (double)AV_TIME_BASE : 0;
+		channels[c]->export_audio = e->cfg.export_audio == c + 1;
+	}
+
+	st = is->video_st;
+	frame_rate = st->r_frame_rate;
+	if(frame_rate.num <= 0 || frame_rate.den <= 0 || av_q2d(frame_rate) > 120)
+		frame_rate = st->avg_frame_rate;
+	if(frame_rate.num <= 0 || frame_rate.den <= 0)
+		frame_rate = (AVRational){ 25, 1 };
+	e->exporter = exporter_open(e->cfg.export_filename, width, height, frame_rate,
+			e->cfg.export_audio ? channels[e->cfg.export_audio - 1]->audio_st->codec->sample_rate : 0,
+			e->cfg.export_audio ? channels[e->cfg.export_audio - 1]->audio_st->codec->channels : 0, &e->cfg);
+	if(!e->exporter)
+		return 1;
+	if(!e->exporter->audio_st)
+		channels[0]->export_audio = channels[1]->export_audio = 0;
+	for(c = 0; c < 2; c++)
+		pthread_create(&audio_tid[c], NULL, export_audio_thread, channels[c]);
+
+	canvas = frame_alloc();
+	for(n = 0; !ended[0] || !ended[1]; n++) {
+		for(c = 0; c < 2; c++) {
+			if(!ended[c])
+				ended[c] = export_channel_advance(channels[c], pictures[c], channels[c]->export_base + n / av_q2d(frame_rate));
+		}
+		composition_layout(&comp, channels, e->exporter->width, e->exporter->height);
+		if(exporter_composite(e->exporter, &comp, canvas) < 0) {
+			fprintf(stderr, "Export: out of memory\n");
+			break;
+		}
+		canvas->pts = n;
+		exporter_put(e->exporter, canvas);
+		if(n % 100 == 0)
+			fprintf(stderr, "\rExport: %d frames, %.1fx real time", n,
+					n / av_q2d(frame_rate) / ((av_gettime() - start + 1) / 1000000.0));
+	}
+	for(c = 0; c < 2; c++)
+		pthread_join(audio_tid[c], NULL);
+	exporter_close(e->exporter);
+	e->exporter = NULL;
+	fprintf(stderr, "\rExport: %d frames (%.1f s) written to %s in %.1f s\n", n, n / av_q2d(frame_rate),
+			e->cfg.export_filename, (av_gettime() - start) / 1000000.0);
+	for(c = 0; c < 2; c++)
+		av_frame_free(&pictures[c]);
+	av_frame_free(&canvas);
+	return 0;
+}
+
+/* CRC32 of the visible bytes of each plane */
+static void verify_hash(Verifier *v, const AVFrame *frame, VerifyHash *h) {
+
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+	int p, y, bytes, height;
+
+	h->nb_planes = desc ? FFMIN(av_pix_fmt_count_planes(frame->format), 4) : 0;
+	for(p = 0; p < h->nb_planes; p++) {
+		bytes = av_image_get_linesize(frame->format, frame->width, p);
+		height = (p == 1 || p == 2) ? -((-frame->height) >> desc->log2_chroma_h) : frame->height;
+		h->crc[p] = UINT32_MAX;
+		for(y = 0; y < height; y++)
+			h->crc[p] = av_crc(v->crc_table, h->crc[p], frame->data[p] + y * frame->linesize[p], bytes);
+		h->crc[p] ^= UINT32_MAX;
+	}
+}
+
+static void *verify_thread(void *arg) {
+
+	Verifier *v = arg;
+	AVFrame *frame = frame_alloc();
+	VerifyHash *h;
+	int c, n;
+
+	pthread_mutex_lock(&v->mutex);
+	for(;;) {
+		while(!v->queue_size && !v->quit) {
+			pthread_cond_wait(&v->cond, &v->mutex);
+		}
+		if(!v->queue_size)
+			break;
+		c = v->queue[v->rindex].channel;
+		n = v->queue[v->rindex].n;
+		av_frame_move_ref(frame, v->queue[v->rindex].frame);
+		h = &v->channels[c].blocks[n / VERIFY_BLOCK_SIZE][n % VERIFY_BLOCK_SIZE];
+		if(++v->rindex == FF_ARRAY_ELEMS(v->queue))
+			v->rindex = 0;
+		v->queue_size--;
+		pthread_mutex_unlock(&v->mutex);
+
+		verify_hash(v, frame, h);
+		av_frame_unref(frame);
+
+		pthread_mutex_lock(&v->mutex);
+		v->channels[c].in_flight--;
+		pthread_cond_broadcast(&v->cond);
+	}
+	pthread_mutex_unlock(&v->mutex);
+	av_frame_free(&frame);
+	return NULL;
+}
+
+/* wake everything that waits on the verifier, for good */
+static void verifier_abort(Verifier *v) {
+
+	pthread_mutex_lock(&v->mutex);
+	v->quit = 1;
+	pthread_cond_broadcast(&v->cond);
+	pthread_mutex_unlock(&v->mutex);
+}
+
+static void verifier_free(Verifier *v) {
+
+	int c, i;
+
+	verifier_abort(v);
+	for(i = 0; i < v->nb_threads; i++)
+		pthread_join(v->threads[i], NULL);
+	for(i = 0; i < FF_ARRAY_ELEMS(v->queue); i++)
+		av_frame_free(&v->queue[i].frame);
+	for(c = 0; c < 2; c++) {
+		for(i = 0; i < v->channels[c].nb_blocks; i++)
+			av_free(v->channels[c].blocks[i]);
+		av_free(v->channels[c].blocks);
+	}
+	av_free(v->threads);
+	pthread_mutex_destroy(&v->mutex);
+	pthread_cond_destroy(&v->cond);
+	av_free(v);
+}
+
+/* one hashing thread per core: hashing is cheaper than decoding, so they
+   mostly sleep, but a slow core never holds up the decoders */
+static Verifier *verifier_open(void) {
+
+	Verifier *v = av_mallocz(sizeof(Verifier));
+	int i, nb_threads = FFMAX(1, sysconf(_SC_NPROCESSORS_ONLN));
+
+	if(!v) return NULL;
+	pthread_mutex_init(&v->mutex, NULL);
+	pthread_cond_init(&v->cond, NULL);
+	v->crc_table = av_crc_get_table(AV_CRC_32_IEEE_LE);
+	for(i = 0; i < FF_ARRAY_ELEMS(v->queue); i++) {
+		if(!(v->queue[i].frame = frame_alloc()))
+			goto fail;
+	}
+	if(!(v->threads = av_mallocz(nb_threads * sizeof(pthread_t))))
+		goto fail;
+	for(v->nb_threads = 0; v->nb_threads < nb_threads; v->nb_threads++) {
+		if(pthread_create(&v->threads[v->nb_threads], NULL, verify_thread, v))
+			break;
+	}
+	if(v->nb_threads)
+		return v;
+
+fail:
+	fprintf(stderr, "Could not start the verifier\n");
+	verifier_free(v);
+	return NULL;
+}
+
+static VerifyHash *verify_hash_at(VerifyChannel *vc, int n) {
+
+	return &vc->blocks[n / VERIFY_BLOCK_SIZE][n % VERIFY_BLOCK_SIZE];
+}
+
+/* Compare the hashes with a verify file written before. Returns the number
+   of pictures that differ, are missing or are extra, -1 on error. */
+static int verify_golden(Verifier *v, const char *filename) {
+
+	FILE *f = fopen(filename, "r");
+	char line[256];
+	VerifyHash g, *h;
+	int c, i, n[2] = { 0, 0 }, differ[2] = { 0, 0 }, wrong = 0;
+
+	if(!f) {
+		fprintf(stderr, "Could not open the golden file %s\n", filename);
+		return -1;
+	}
+	while(fgets(line, sizeof(line), f)) {
+		if(line[0] == '#')
+			continue;
+		i = sscanf(line, "%d, %lf, %x, %x, %x, %x", &c, &g.pts, &g.crc[0], &g.crc[1], &g.crc[2], &g.crc[3]);
+		if(i < 2 || c < 1 || c > 2)
+			continue;
+		c--;
+		g.nb_planes = i - 2;
+		if(n[c] < v->channels[c].count) {
+			h = verify_hash_at(&v->channels[c], n[c]);
+			if(h->nb_planes != g.nb_planes || memcmp(h->crc, g.crc, g.nb_planes * sizeof(g.crc[0])) ||
+					fabs(h->pts - g.pts) > 1e-6) {
+				if(!differ[c]++)
+					fprintf(stderr, "Channel %d: picture %d (pts %.6f) differs from %s\n", c + 1, n[c], h->pts, filename);
+			}
+		}
+		n[c]++;
+	}
+	fclose(f);
+	for(c = 0; c < 2; c++) {
+		i = v->channels[c].count;
+		fprintf(stderr, "Channel %d: %d pictures, %d differ, %d missing, %d extra\n", c + 1, i, differ[c],
+				FFMAX(n[c] - i, 0), FFMAX(i - n[c], 0));
+		wrong += differ[c] + abs(n[c] - i);
+	}
+	return wrong;
+}
+
+/* Verify mode: both channels decode as fast as they can, with no display
+   and no audio, and every picture is hashed. The hashes are written like
+   framecrc, one line per picture (channel, pts, CRC32 of each plane), and
+   checked against a golden file when there is one. Returns 0 when all is
+   well. */
+int player_verify(PlayerEngine *e) {
+
+	Verifier *v = e->verifier;
+	pthread_t audio_tid[2];
+	int64_t start = av_gettime();
+	FILE *out = NULL;
+	VerifyHash *h;
+	int c, i, p, total, ret = 0;
+
+	for(c = 0; c < 2; c++) {
+		if(export_wait_opened(e->channels[c]) < 0)
+			return 1;
+	}
+	for(c = 0; c < 2; c++) {
+		/* nobody listens: the audio packets are thrown away */
+		e->channels[c]->export_audio = 0;
+		pthread_create(&audio_tid[c], NULL, export_audio_thread, e->channels[c]);
+	}
+	pthread_mutex_lock(&v->mutex);
+	while(!v->quit && (!v->channels[0].ended || !v->channels[1].ended ||
+			v->channels[0].in_flight || v->channels[1].in_flight)) {
+		pthread_cond_wait(&v->cond, &v->mutex);
+		total = v->channels[0].count + v->channels[1].count;
+		if(total % 100 == 0)
+			fprintf(stderr, "\rVerify: %d pictures, %.0f per second", total,
+					total / ((av_gettime() - start + 1) / 1000000.0));
+	}
+	pthread_mutex_unlock(&v->mutex);
+	for(c = 0; c < 2; c++)
+		pthread_join(audio_tid[c], NULL);
+	total = v->channels[0].count + v->channels[1].count;
+	fprintf(stderr, "\rVerify: %d pictures hashed in %.1f s\n", total, (av_gettime() - start) / 1000000.0);
+
+	if(e->cfg.verify_filename) {
+		out = strcmp(e->cfg.verify_filename, "-") ? fopen(e->cfg.verify_filename, "w") : stdout;
+		if(!out) {
+			fprintf(stderr, "Could not open %s\n", e->cfg.verify_filename);
+			return 1;
+		}
+		fprintf(out, "#format: channel, pts, CRC32 of each plane\n");
+		for(c = 0; c < 2; c++)
+			fprintf(out, "#channel %d: %s\n", c + 1, e->channels[c]->filename);
+		for(c = 0; c < 2; c++) {
+			for(i = 0; i < v->channels[c].count; i++) {
+				h = verify_hash_at(&v->channels[c], i);
+				fprintf(out, "%d, %.6f", c + 1, h->pts);
+				for(p = 0; p < h->nb_planes; p++)
+					fprintf(out, ", %08x", h->crc[p]);
+				fprintf(out, "\n");
+			}
+		}
+		if(out != stdout)
+			fclose(out);
+	}
+	if(e->cfg.golden_filename) {
+		ret = verify_golden(v, e->cfg.golden_filename);
+		fprintf(stderr, ret ? "Verify: FAILED\n" : "Verify: all pictures match\n");
+	}
+	return ret != 0;
+}
+
+/* Virtual clock: no timers and no audio device. This thread runs the
+   refreshes of both channels and the audio callback in the order they
+   are due and moves the clock straight to the next one; a channel whose
+   next picture is not decoded yet holds the clock until it is. The sync
+   logic sees the same times on every run, as fast as the decoders go,
+   and every decision goes to the log. */
+int player_simulate(PlayerEngine *e) {
+
+	VideoState *is;
+	uint8_t *audio = NULL;
+	int64_t start = av_gettime(), next, buffers = 0;
+	int c, due, waiting, refreshes = 0;
+
+	for(c = 0; c < 2; c++) {
+		if(export_wait_opened(e->channels[c]) < 0)
+			return 1;
+	}
+	e->virtual_log = strcmp(e->cfg.virtual_filename, "-") ? fopen(e->cfg.virtual_filename, "w") : stdout;
+	if(!e->virtual_log) {
+		fprintf(stderr, "Could not open %s\n", e->cfg.virtual_filename);
+		return 1;
+	}
+	fprintf(e->virtual_log, "#time channel video pts delay <d> av <audio clock - pts>\n"
+			"#time channel audio <audio clock> diff <from the master clock> samples <in> <out>\n");
+	if(e->spec.size && !(audio = av_malloc(e->spec.size)))
+		return 1;
+
+	for(;;) {
+		SDL_LockMutex(e->virtual_mutex);
+		for(;;) {
+			/* the audio device plays a buffer every spec.samples samples,
+			   ahead of a refresh due at the same time */
+			next = audio ? buffers * e->spec.samples * 1000000 / e->spec.freq : INT64_MAX;
+			due = -1;
+			waiting = 0;
+			for(c = 0; c < 2; c++) {
+				is = e->channels[c];
+				if(is->video_ended)
+					continue;
+				if(is->refresh_due < 0)
+					waiting = 1;
+				else if(is->refresh_due < next) {
+					next = is->refresh_due;
+					due = c;
+				}
+			}
+			if(!waiting || e->channels[0]->quit)
+				break;
+			SDL_CondWait(e->virtual_cond, e->virtual_mutex);
+		}
+		if(e->channels[0]->quit || (e->channels[0]->video_ended && e->channels[1]->video_ended)) {
+			SDL_UnlockMutex(e->virtual_mutex);
+			break;
+		}
+		e->virtual_time = next;
+		if(due >= 0)
+			e->channels[due]->refresh_due = -1;
+		SDL_UnlockMutex(e->virtual_mutex);
+
+		if(due < 0) {
+			audio_callback_manager(e->channels[0], audio, e->spec.size);
+			buffers++;
+			continue;
+		}
+		video_refresh_timer(e->channels[due]);
+		if(++refreshes % 100 == 0)
+			fprintf(stderr, "\rVirtual clock: %.1f s played, %.1fx real time", e->virtual_time / 1000000.0,
+					e->virtual_time / (double)(av_gettime() - start + 1));
+	}
+	fprintf(stderr, "\rVirtual clock: %.1f s played in %.1f s\n", e->virtual_time / 1000000.0,
+			(av_gettime() - start) / 1000000.0);
+	is = e->audio_channel;
+	if(is->av_count)
+		fprintf(stderr, "Channel %d A/V: mean %+.1f ms, max %.1f ms over %d pictures\n", is->is_small ? 2 : 1,
+				is->av_sum / is->av_count * 1000, is->av_max * 1000, is->av_count);
+	if(e->virtual_log != stdout)
+		fclose(e->virtual_log);
+	e->virtual_log = NULL;
+	av_free(audio);
+	return 0;
+}
+
+void recorder_free(Recorder *rec) {
+
+	int i, c;
+
+	for(i = 0; i < RECORD_QUEUE_SIZE; i++) {
+		for(c = 0; c < 2; c++)
+			av_frame_free(&rec->queue[i].pictures[c]);
+	}
+	av_free(rec->audio_ring);
+	pthread_mutex_destroy(&rec->mutex);
+	pthread_cond_destroy(&rec->cond);
+	pthread_mutex_destroy(&rec->audio_mutex);
+	av_free(rec);
+}
+
+/* move the audio played so far to the exporter */
+static void recorder_drain_audio(Recorder *rec) {
+
+	uint8_t buf[16384];
+	int n, frame_bytes = 2 * rec->audio_channels;
+	double pts;
+
+	if(!rec->ex->audio_st)
+		return;
+	for(;;) {
+		pthread_mutex_lock(&rec->audio_mutex);
+		n = FFMIN(rec->audio_fill, rec->audio_ring_size - rec->audio_rindex);
+		n = FFMIN(n, sizeof(buf)) / frame_bytes * frame_bytes;
+		memcpy(buf, rec->audio_ring + rec->audio_rindex, n);
+		rec->audio_rindex = (rec->audio_rindex + n) % rec->audio_ring_size;
+		rec->audio_fill -= n;
+		pts = (rec->audio_start - rec->start) / 1000000.0;
+		pthread_mutex_unlock(&rec->audio_mutex);
+		if(n <= 0)
+			break;
+		exporter_put_audio(rec->ex, buf, n / frame_bytes, rec->audio_rate, rec->audio_channels, pts);
+	}
+}
+
+/* Recorder thread: opens the file (encoder setup would stall the display),
+   then composites the captured screens and hands them to the encoder
+   thread. The screen updates of both channels are put on a fixed frame
+   grid; several updates within one frame keep the first. */
+static void *recorder_thread(void *arg) {
+
+	Recorder *rec = arg;
+	AVFrame *canvas = av_frame_alloc();
+	Composition comp;
+	int64_t pts;
+	int c;
+
+	rec->ex = exporter_open(rec->filename, rec->width, rec->height, (AVRational){ RECORD_FRAME_RATE, 1 },
+			rec->audio_rate, rec->audio_channels, &rec->cfg);
+	if(!rec->ex)
+		fprintf(stderr, "Recording to %s failed\n", rec->filename);
+
+	pthread_mutex_lock(&rec->mutex);
+	for(;;) {
+		while(!rec->queue_size && !rec->stop) {
+			pthread_cond_wait(&rec->cond, &rec->mutex);
+		}
+		if(!rec->queue_size)
+			break;
+		comp = rec->queue[rec->rindex];
+		pthread_mutex_unlock(&rec->mutex);
+
+		if(rec->ex && canvas) {
+			recorder_drain_audio(rec);
+			pts = av_rescale(comp.time - rec->start, RECORD_FRAME_RATE, 1000000);
+			if(pts > rec->last_pts && !exporter_composite(rec->ex, &comp, canvas)) {
+				canvas->pts = rec->last_pts = pts;
+				exporter_put(rec->ex, canvas);
+			}
+		}
+		for(c = 0; c < 2; c++)
+			av_frame_unref(comp.pictures[c]);
+
+		pthread_mutex_lock(&rec->mutex);
+		if(++rec->rindex == RECORD_QUEUE_SIZE)
+			rec->rindex = 0;
+		rec->queue_size--;
+	}
+	pthread_mutex_unlock(&rec->mutex);
+
+	if(rec->ex) {
+		recorder_drain_audio(rec);
+		if(rec->ex->audio_st)
+			exporter_cut_audio(rec->ex, 1);
+		exporter_close(rec->ex);
+		printf("Recording %s saved: %d screens captured, %d dropped, %.2f s of audio dropped\n",
+				rec->filename, rec->captured, rec->dropped,
+				rec->audio_channels ? rec->audio_dropped / (2.0 * rec->audio_channels * rec->audio_rate) : 0.0);
+	}
+	av_frame_free(&canvas);
+	recorder_free(rec);
+	return NULL;
+}
+
+/* 'v': record what the window shows and what is played to a new file */
+Recorder *recorder_start(VideoState *is) {
+
+	PlayerEngine *e = is->engine;
+	Recorder *rec = av_mallocz(sizeof(Recorder));
+	char name[11];
+	int i, c;
+
+	if(!rec) return NULL;
+	pthread_mutex_init(&rec->mutex, NULL);
+	pthread_cond_init(&rec->cond, NULL);
+	pthread_mutex_init(&rec->audio_mutex, NULL);
+	for(i = 0; i < RECORD_QUEUE_SIZE; i++) {
+		for(c = 0; c < 2; c++) {
+			if(!(rec->queue[i].pictures[c] = frame_alloc()))
+				goto fail;
+		}
+	}
+	do {
+		gen_random(name, 10);
+		snprintf(rec->filename, sizeof(rec->filename), "%s.%s", name, e->cfg.record_format);
+	} while(file_exist(rec->filename));
+
+	rec->channels[0] = is;
+	rec->channels[1] = is->is2;
+	rec->cfg = e->cfg;
+	rec->width = e->screen->w;
+	rec->height = e->screen->h;
+	rec->start = av_gettime();
+	rec->last_pts = -1;
+	if(e->audio_open && e->spec.freq > 0 && e->spec.channels > 0) {
+		rec->audio_rate = e->spec.freq;
+		rec->audio_channels = e->spec.channels;
+		rec->audio_ring_size = e->spec.freq * 2 * e->spec.channels * RECORD_AUDIO_SECONDS;
+		if(!(rec->audio_ring = av_malloc(rec->audio_ring_size)))
+			goto fail;
+	}
+	if(pthread_create(&rec->thread, NULL, recorder_thread, rec))
+		goto fail;
+	printf("Recording to %s\n", rec->filename);
+	return rec;
+
+fail:
+	fprintf(stderr, "Could not start recording\n");
+	recorder_free(rec);
+	return NULL;
+}
+
+/* wait for the recording stopped last to finish its file */
+static void recorder_join(PlayerEngine *e) {
+
+	if(e->recorder_thread)
+		pthread_join(e->recorder_thread, NULL);
+	e->recorder_thread = 0;
+}
+
+/* Stop the recording; the recorder thread finishes the file in the
+   background unless 'wait' is set, and is joined when the next recording
+   stops or the engine closes. */
+void recorder_stop(PlayerEngine *e, int wait) {
+
+	Recorder *rec = e->recorder;
+	pthread_t thread = rec->thread;
+	int c;
+
+	/* the audio callback must be done with it */
+	SDL_LockAudio();
+	e->recorder = NULL;
+	SDL_UnlockAudio();
+	for(c = 0; c < 2; c++)
+		av_frame_unref(rec->channels[c]->shown_frame);
+
+	pthread_mutex_lock(&rec->mutex);
+	rec->stop = 1;
+	pthread_cond_signal(&rec->cond);
+	pthread_mutex_unlock(&rec->mutex);
+	recorder_join(e);
+	if(wait)
+		pthread_join(thread, NULL);
+	else
+		e->recorder_thread = thread;
+}
+
+/* sum of the squared differences of 'width' pixels */
+static uint64_t sse_line(const uint8_t *a, const uint8_t *b, int width) {
+
+	uint64_t sse = 0;
+	int x = 0, d;
+#ifdef __SSE2__
+	__m128i zero = _mm_setzero_si128(), acc = zero, va, vb, lo, hi;
+	uint32_t lanes[4];
+
+	// 32 bit lanes hold 16500 iterations, far more than any line
+	for(; x + 16 <= width; x += 16) {
+		va = _mm_loadu_si128((const __m128i *)(a + x));
+		vb = _mm_loadu_si128((const __m128i *)(b + x));
+		lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+		hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+		acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+	}
+	_mm_storeu_si128((__m128i *)lanes, acc);
+	sse = (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+	for(; x < width; x++) {
+		d = a[x] - b[x];
+		sse += d * d;
+	}
+	return sse;
+}
+
+static double plane_psnr(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride, int width, int height) {
+
+	uint64_t sse = 0;
+	int y;
+
+	for(y = 0; y < height; y++)
+		sse += sse_line(a + y * a_stride, b + y * b_stride, width);
+	if(!sse)
+		return INFINITY;
+	return 10 * log10(255.0 * 255.0 * width * height / sse);
+}
+
+/* Sums of a row of 4x4 blocks: of a, of b, of a^2 + b^2 and of a * b. */
+static void ssim_4x4_line(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride, int (*sums)[4], int nb_blocks) {
+
+	int i = 0, x, y, pa, pb;
+#ifdef __SSE2__
+	__m128i zero = _mm_setzero_si128(), one = _mm_set1_epi16(1);
+	__m128i s1, s2, ss, s12, va, vb;
+	int lanes[4][4];
+
+	// two blocks at a time: lanes 0 and 1 are the first, 2 and 3 the second
+	for(; i + 2 <= nb_blocks; i += 2) {
+		s1 = s2 = ss = s12 = zero;
+		for(y = 0; y < 4; y++) {
+			va = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(a + y * a_stride + 4 * i)), zero);
+			vb = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(b + y * b_stride + 4 * i)), zero);
+			s1 = _mm_add_epi16(s1, va);
+			s2 = _mm_add_epi16(s2, vb);
+			ss = _mm_add_epi32(ss, _mm_add_epi32(_mm_madd_epi16(va, va), _mm_madd_epi16(vb, vb)));
+			s12 = _mm_add_epi32(s12, _mm_madd_epi16(va, vb));
+		}
+		_mm_storeu_si128((__m128i *)lanes[0], _mm_madd_epi16(s1, one));
+		_mm_storeu_si128((__m128i *)lanes[1], _mm_madd_epi16(s2, one));
+		_mm_storeu_si128((__m128i *)lanes[2], ss);
+		_mm_storeu_si128((__m128i *)lanes[3], s12);
+		for(x = 0; x < 2; x++) {
+			for(y = 0; y < 4; y++)
+				sums[i + x][y] = lanes[y][2 * x] + lanes[y][2 * x + 1];
+		}
+	}
+#endif
+	for(; i < nb_blocks; i++) {
+		memset(sums[i], 0, sizeof(sums[i]));
+		for(y = 0; y < 4; y++) {
+			for(x = 4 * i; x < 4 * i + 4; x++) {
+				pa = a[y * a_stride + x];
+				pb = b[y * b_stride + x];
+				sums[i][0] += pa;
+				sums[i][1] += pb;
+				sums[i][2] += pa * pa + pb * pb;
+				sums[i][3] += pa * pb;
+			}
+		}
+	}
+}
+
+/* SSIM of one 8x8 window from its sums (8 bit, so it fits in ints) */
+static double ssim_window(const int t[4]) {
+
+	static const int c1 = (int)(.01 * .01 * 255 * 255 * 64 + .5);
+	static const int c2 = (int)(.03 * .03 * 255 * 255 * 64 * 63 + .5);
+	int vars = t[2] * 64 - t[0] * t[0] - t[1] * t[1];
+	int covar = t[3] * 64 - t[0] * t[1];
+
+	return (double)(2 * t[0] * t[1] + c1) * (2 * covar + c2) /
+			((double)(t[0] * t[0] + t[1] * t[1] + c1) * (vars + c2));
+}
+
+/* mean SSIM over 8x8 windows overlapping by 4, as x264 and ffmpeg do */
+static double plane_ssim(Comparator *cmp, const uint8_t *a, int a_stride, const uint8_t *b, int b_stride, int width, int height) {
+
+	int (*prev)[4], (*cur)[4], (*tmp)[4];
+	int bw = width / 4, bh = height / 4, x, y, k, t[4];
+	double ssim = 0;
+
+	if(bw < 2 || bh < 2)
+		return NAN;
+	av_fast_malloc(&cmp->ssim_sums, &cmp->ssim_sums_size, 2 * bw * sizeof(*cmp->ssim_sums));
+	if(!cmp->ssim_sums)
+		return NAN;
+	prev = cmp->ssim_sums;
+	cur = prev + bw;
+	ssim_4x4_line(a, a_stride, b, b_stride, prev, bw);
+	for(y = 1; y < bh; y++) {
+		ssim_4x4_line(a + 4 * y * a_stride, a_stride, b + 4 * y * b_stride, b_stride, cur, bw);
+		for(x = 0; x < bw - 1; x++) {
+			for(k = 0; k < 4; k++)
+				t[k] = prev[x][k] + prev[x + 1][k] + cur[x][k] + cur[x + 1][k];
+			ssim += ssim_window(t);
+		}
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
+	}
+	return ssim / ((bw - 1) * (bh - 1));
+}
+
+/* Measure the pair: the second picture is brought to the format and size
+   of the primary one if they differ. */
+static int compare_pictures(Comparator *cmp, double psnr[3], double ssim[3]) {
+
+	const AVFrame *planes[2];
+	AVFrame *picture;
+	int c, p, w = cmp->pictures[0]->width, h = cmp->pictures[0]->height;
+
+	for(c = 0; c < 2; c++) {
+		picture = cmp->pictures[c];
+		planes[c] = picture;
+		if(picture->format == AV_PIX_FMT_YUV420P && picture->width == w && picture->height == h)
+			continue;
+		cmp->converted[c]->format = AV_PIX_FMT_YUV420P;
+		cmp->converted[c]->width = w;
+		cmp->converted[c]->height = h;
+		if(frame_pool_get(&cmp->pool, cmp->converted[c], w, h) < 0)
+			return -1;
+		cmp->sws[c] = sws_getCachedContext(cmp->sws[c], picture->width, picture->height, picture->format,
+				w, h, AV_PIX_FMT_YUV420P, SWS_BICUBIC, NULL, NULL, NULL);
+		if(!cmp->sws[c])
+			return -1;
+		sws_scale(cmp->sws[c], (uint8_t const * const *)picture->data, picture->linesize, 0, picture->height,
+				cmp->converted[c]->data, cmp->converted[c]->linesize);
+		planes[c] = cmp->converted[c];
+	}
+	for(p = 0; p < 3; p++) {
+		if(p == 1) {
+			w = (w + 1) / 2;
+			h = (h + 1) / 2;
+		}
+		psnr[p] = plane_psnr(planes[0]->data[p], planes[0]->linesize[p], planes[1]->data[p], planes[1]->linesize[p], w, h);
+		ssim[p] = plane_ssim(cmp, planes[0]->data[p], planes[0]->linesize[p], planes[1]->data[p], planes[1]->linesize[p], w, h);
+	}
+	return 0;
+}
+
+static void *compare_thread(void *arg) {
+
+	Comparator *cmp = arg;
+	double psnr[3], ssim[3];
+	int c, ret;
+
+	pthread_mutex_lock(&cmp->mutex);
+	for(;;) {
+		while(!cmp->busy && !cmp->quit) {
+			pthread_cond_wait(&cmp->cond, &cmp->mutex);
+		}
+		if(!cmp->busy)
+			break;
+		pthread_mutex_unlock(&cmp->mutex);
+
+		ret = compare_pictures(cmp, psnr, ssim);
+		for(c = 0; c < 2; c++) {
+			av_frame_unref(cmp->pictures[c]);
+			av_frame_unref(cmp->converted[c]);
+		}
+		if(!ret && cmp->log)
+			fprintf(cmp->log, "%.3f,%.4f,%.4f,%.4f,%.6f,%.6f,%.6f\n",
+					cmp->pts, psnr[0], psnr[1], psnr[2], ssim[0], ssim[1], ssim[2]);
+
+		pthread_mutex_lock(&cmp->mutex);
+		if(!ret) {
+			memcpy(cmp->psnr, psnr, sizeof(psnr));
+			memcpy(cmp->ssim, ssim, sizeof(ssim));
+			if(isfinite(psnr[0])) {
+				cmp->psnr_sum += psnr[0];
+				cmp->psnr_count++;
+			}
+			cmp->ssim_sum += ssim[0];
+			cmp->compared++;
+		}
+		cmp->busy = 0;
+	}
+	pthread_mutex_unlock(&cmp->mutex);
+	return NULL;
+}
+
+static void compare_free(Comparator *cmp) {
+
+	int c;
+
+	for(c = 0; c < 2; c++) {
+		av_frame_free(&cmp->pictures[c]);
+		av_frame_free(&cmp->converted[c]);
+		sws_freeContext(cmp->sws[c]);
+	}
+	frame_pool_uninit(&cmp->pool);
+	av_free(cmp->ssim_sums);
+	if(cmp->log)
+		fclose(cmp->log);
+	pthread_mutex_destroy(&cmp->mutex);
+	pthread_cond_destroy(&cmp->cond);
+	av_free(cmp);
+}
+
+/* 'a': measure the channels against each other, the primary being the
+   reference, and log every pair to a new CSV file */
+static Comparator *compare_start(PlayerEngine *e) {
+
+	Comparator *cmp = av_mallocz(sizeof(Comparator));
+	char name[11];
+	int c;
+
+	if(!cmp) return NULL;
+	pthread_mutex_init(&cmp->mutex, NULL);
+	pthread_cond_init(&cmp->cond, NULL);
+	for(c = 0; c < 2; c++) {
+		cmp->serials[c] = e->channels[c]->shown_serial;
+		if(!(cmp->pictures[c] = frame_alloc()) || !(cmp->converted[c] = frame_alloc()))
+			goto fail;
+	}
+	do {
+		gen_random(name, 10);
+		snprintf(cmp->filename, sizeof(cmp->filename), "%s.csv", name);
+	} while(file_exist(cmp->filename));
+	if(!(cmp->log = fopen(cmp->filename, "w")))
+		fprintf(stderr, "Could not open %s, the comparison is not logged\n", cmp->filename);
+	else
+		fprintf(cmp->log, "pts,psnr_y,psnr_u,psnr_v,ssim_y,ssim_u,ssim_v\n");
+	if(pthread_create(&cmp->thread, NULL, compare_thread, cmp))
+		goto fail;
+	printf("Comparing the channels, logged to %s\n", cmp->filename);
+	return cmp;
+
+fail:
+	fprintf(stderr, "Could not start the comparison\n");
+	compare_free(cmp);
+	return NULL;
+}
+
+static void compare_print_stats(Comparator *cmp) {
+
+	pthread_mutex_lock(&cmp->mutex);
+	printf("Comparison: %d pairs measured, %d skipped", cmp->compared, cmp->skipped);
+	if(cmp->compared)
+		printf(", average luma PSNR %.2f dB (%d identical), SSIM %.4f",
+				cmp->psnr_count ? cmp->psnr_sum / cmp->psnr_count : INFINITY,
+				cmp->compared - cmp->psnr_count, cmp->ssim_sum / cmp->compared);
+	printf("\n");
+	pthread_mutex_unlock(&cmp->mutex);
+}
+
+static void compare_stop(PlayerEngine *e) {
+
+	Comparator *cmp = e->comparator;
+
+	e->comparator = NULL;
+	pthread_mutex_lock(&cmp->mutex);
+	cmp->quit = 1;
+	pthread_cond_signal(&cmp->cond);
+	pthread_mutex_unlock(&cmp->mutex);
+	pthread_join(cmp->thread, NULL);
+	compare_print_stats(cmp);
+	if(cmp->log)
+		printf("Comparison log %s saved\n", cmp->filename);
+	if(e->screen)
+		SDL_WM_SetCaption("", NULL);
+	compare_free(cmp);
+}
+
+/* Throughput of the sliced color filter on a synthetic YUV420P picture
+   for 1 up to one thread per core, to show how it scales. The shared
+   worker pool is set aside meanwhile, so no engine should be running. */
+int player_bench_filter(const PlayerConfig *cfg, int width, int height) {
+
+	WorkerPool *shared = worker_pool;
+	Lut3D *color_lut = NULL;
+	AVFrame *src, *dst;
+	ColorFilter filter;
+	int nb_cpus = FFMAX(1, sysconf(_SC_NPROCESSORS_ONLN));
+	int color_flag;
+	int threads, frames, x, y;
+	int64_t start, elapsed;
+	double fps, base_fps = 0;
+
+	if(cfg->lut_filename && !(color_lut = lut3d_load(cfg->lut_filename)))
+		return 1;
+	color_flag = color_lut ? 6 : 1;
+	src = frame_alloc();
+	dst = frame_alloc();
+	src->format = dst->format = AV_PIX_FMT_YUV420P;
+	src->width = dst->width = width;
+	src->height = dst->height = height;
+	if(av_frame_get_buffer(src, FRAME_POOL_ALIGN) < 0 || av_frame_get_buffer(dst, FRAME_POOL_ALIGN) < 0) {
+		fprintf(stderr, "Could not allocate a %dx%d picture\n", width, height);
+		return 1;
+	}
+	for(y = 0; y < height; y++) {
+		for(x = 0; x < width; x++)
+			src->data[0][y * src->linesize[0] + x] = x + y;
+	}
+	for(y = 0; y < height / 2; y++) {
+		memset(src->data[1] + y * src->linesize[1], y, width / 2);
+		memset(src->data[2] + y * src->linesize[2], 255 - y, width / 2);
+	}
+
+	printf("Color filter (%s) on %dx%d YUV420P\n", color_lut ? "3D LUT" : "black & white", width, height);
+	for(threads = 1; threads <= nb_cpus; threads++) {
+		worker_pool = worker_pool_create(threads - 1);
+		memset(&filter, 0, sizeof(filter));
+		filter.lut = color_lut;
+		color_filter_run(&filter, src, dst, color_flag);	/* warm up: scalers and buffers */
+		frames = 0;
+		start = av_gettime();
+		do {
+			color_filter_run(&filter, src, dst, color_flag);
+			frames++;
+			elapsed = av_gettime() - start;
+		} while(elapsed < 1000000 || frames < 10);
+		fps = frames * 1000000.0 / elapsed;
+		if(threads == 1)
+			base_fps = fps;
+		printf("%3d threads %3d slices: %8.1f fps  x%.2f\n", threads, filter.nb_slices, fps, fps / base_fps);
+		color_filter_uninit(&filter);
+		worker_pool_free(worker_pool);
+		worker_pool = NULL;
+	}
+	worker_pool = shared;
+	av_frame_free(&src);
+	av_frame_free(&dst);
+	lut3d_free(&color_lut);
+	return 0;
+}
+
+int player_init(int nb_threads) {
+
+	av_register_all();
+	av_init_packet(&flush_pkt);
+	flush_pkt.data = (unsigned char *)"FLUSH";
+	av_init_packet(&switch_pkt);
+	switch_pkt.data = (unsigned char *)"SWITCH";
+	av_init_packet(&eof_pkt);
+	eof_pkt.data = (unsigned char *)"EOF";
+	av_init_packet(&loop_pkt);
+	loop_pkt.data = (unsigned char *)"LOOP";
+	// threads shared by the color filters of every channel of every engine
+	if(nb_threads < 0)
+		nb_threads = FFMAX(0, sysconf(_SC_NPROCESSORS_ONLN) - 1);
+	worker_pool = worker_pool_create(nb_threads);
+	return 0;
+}
+
+void player_uninit(void) {
+
+	int i;
+
+	worker_pool_free(worker_pool);
+	worker_pool = NULL;
+	pthread_mutex_lock(&probe_cache_mutex);
+	for(i = 0; i < PROBE_CACHE_SIZE; i++)
+		probe_cache_entry_clear(&probe_cache[i]);
+	pthread_mutex_unlock(&probe_cache_mutex);
+}
+
+void player_set_mem_budget(int64_t bytes) {
+
+	mem_budget.budget = bytes;
+	mem_budget.warned = 0;
+}
+
+void player_config_defaults(PlayerConfig *cfg) {
+
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->latency = 0.2;
+	cfg->width = 640;
+	cfg->height = 480;
+	cfg->audio_device = 1;
+	cfg->export_audio = 1;
+	cfg->record_format = "mkv";
+	cfg->intra_decoders = -1;
+	cfg->speed = 1.0;
+}
+
+static void channel_free(VideoState *is) {
+
+	MediaSource *sources[8], *src;
+	int i, j, n = 0;
+
+	if(!is) return;
+	/* the items the decoders are still on lead to the one the demuxer
+	   reads; the preloaded and retired ones hang off the side */
+	for(src = is->audio_src; src && n < FF_ARRAY_ELEMS(sources); src = src->next)
+		sources[n++] = src;
+	for(src = is->video_src; src && n < FF_ARRAY_ELEMS(sources); src = src->next) {
+		for(j = 0; j < n && sources[j] != src; j++);
+		if(j == n)
+			sources[n++] = src;
+	}
+	if(is->preloaded && n < FF_ARRAY_ELEMS(sources))
+		sources[n++] = is->preloaded;
+	for(src = is->retired; src && n < FF_ARRAY_ELEMS(sources); src = src->retired_next)
+		sources[n++] = src;
+	for(i = 0; i < n; i++)
+		source_free(sources[i]);
+
+	packet_queue_destroy(&is->audioq);
+	packet_queue_destroy(&is->videoq);
+	loop_cache_free(is);
+	loop_frames_free(is);
+	av_free_packet(&is->audio_pkt);
+	av_frame_unref(&is->audio_frame);
+	av_freep(&is->audio_buf);
+	stretch_free(&is->stretch);
+	swr_free((struct SwrContext **)&is->sws_ctx_audio);
+	sws_freeContext(is->sws_ctx);
+	frame_pool_uninit(&is->filter_pool);
+	for(i = 0; i < VIDEO_PICTURE_QUEUE_SIZE; i++) {
+		av_frame_free(&is->colorq[i]);
+		av_frame_free(&is->pictq[i].frame);
+		if(is->pictq[i].bmp)
+			overlay_free(is, is->pictq[i].bmp);
+	}
+	av_frame_free(&is->shown_frame);
+	SDL_DestroyMutex(is->pictq_mutex);
+	SDL_DestroyCond(is->pictq_cond);
+	SDL_DestroyMutex(is->colorq_mutex);
+	SDL_DestroyCond(is->colorq_cond);
+	SDL_DestroyMutex(is->read_mutex);
+	SDL_DestroyCond(is->read_cond);
+	SDL_DestroyCond(is->preload_cond);
+	for(i = 0; i < is->playlist.nb_items; i++)
+		av_free(is->playlist.items[i]);
+	av_free(is->playlist.items);
+	/* what is still charged: audio buffers, pools of frames in flight */
+	__sync_fetch_and_sub(&mem_budget.fixed, channel_fixed_memory(is));
+	__sync_fetch_and_sub(&mem_budget.rate, is->byte_rate);
+	av_free(is);
+}
+
+/* a channel plays a media file, a playlist or a directory */
+static VideoState *channel_create(PlayerEngine *e, const char *path, int is_small) {
+
+	VideoState *is = av_mallocz(sizeof(VideoState));
+	int i;
+
+	if(!is) return NULL;
+	is->engine = e;
+	is->is_small = is_small;
+	is->flag_sound = 1;
+	is->color_flag = e->cfg.filter;
+	is->av_sync_type = DEFAULT_AV_SYNC_TYPE;
+	is->refresh_due = -1;
+	is->stretch.speed = 1.0;
+	is->filter_pool.usage = &is->mem_frames;
+	packet_queue_init(&is->audioq);
+	packet_queue_init(&is->videoq);
+	for(i = 0; i < VIDEO_PICTURE_QUEUE_SIZE; i++)
+		is->pictq[i].frame = frame_alloc();
+	is->shown_frame = frame_alloc();
+	is->pictq_mutex = SDL_CreateMutex();
+	is->pictq_cond = SDL_CreateCond();
+	is->colorq_mutex = SDL_CreateMutex();
+	is->colorq_cond = SDL_CreateCond();
+	is->read_mutex = SDL_CreateMutex();
+	is->read_cond = SDL_CreateCond();
+	is->preload_cond = SDL_CreateCond();
+	if(playlist_load(&is->playlist, path) < 0) {
+		fprintf(stderr, "Nothing to play in %s\n", path);
+		channel_free(is);
+		return NULL;
+	}
+	av_strlcpy(is->filename, is->playlist.items[0], sizeof(is->filename));
+	return is;
+}
+
+/* tell every thread of the channel to stop and wake it wherever it waits */
+static void channel_stop(VideoState *is) {
+
+	is->quit = 1;
+	packet_queue_abort(&is->audioq);
+	packet_queue_abort(&is->videoq);
+	SDL_LockMutex(is->pictq_mutex);
+	SDL_CondBroadcast(is->pictq_cond);
+	SDL_UnlockMutex(is->pictq_mutex);
+	SDL_LockMutex(is->colorq_mutex);
+	SDL_CondBroadcast(is->colorq_cond);
+	SDL_UnlockMutex(is->colorq_mutex);
+	SDL_LockMutex(is->read_mutex);
+	SDL_CondBroadcast(is->read_cond);
+	SDL_CondBroadcast(is->preload_cond);
+	SDL_UnlockMutex(is->read_mutex);
+}
+
+PlayerEngine *player_open(const PlayerConfig *cfg, const char *primary, const char *second, SDL_Surface *screen) {
+
+	PlayerEngine *e = av_mallocz(sizeof(PlayerEngine));
+	int c;
+
+	if(!e) return NULL;
+	e->cfg = *cfg;
+	if(!e->cfg.record_format)
+		e->cfg.record_format = "mkv";
+	e->screen = screen;
+	e->renderer = &renderers[av_clip(e->cfg.renderer, 0, FF_ARRAY_ELEMS(renderers) - 1)];
+	e->multi_videos = 1;
+	e->wipe_pos = 0.5;
+	e->virtual_clock = e->cfg.virtual_filename && !e->cfg.export_filename && !e->cfg.verify;
+	e->headless = e->cfg.export_filename || e->cfg.verify || e->virtual_clock;
+	e->launch_time = av_gettime();
+	e->nosync_threshold = AV_NOSYNC_THRESHOLD;
+	if(e->virtual_clock) {
+		/* nothing arrives on a virtual clock */
+		e->cfg.live = 0;
+		e->virtual_mutex = SDL_CreateMutex();
+		e->virtual_cond = SDL_CreateCond();
+	}
+	if(e->cfg.live) {
+		/* no point probing what has not arrived yet, and a live clock
+		   that jumps is resynced rather than waited for */
+		e->cfg.fast_start = 1;
+		e->nosync_threshold = FFMAX(LIVE_NOSYNC_THRESHOLD, 2 * e->cfg.latency);
+	}
+	/* exports and verifications are of the media as it is, live sources
+	   play at the speed they arrive */
+	e->speed = e->cfg.export_filename || e->cfg.verify || e->cfg.live ? 1.0 :
+			av_clipd(e->cfg.speed > 0 ? e->cfg.speed : 1.0, SPEED_MIN, SPEED_MAX);
+	if(e->cfg.lut_filename && !(e->lut = lut3d_load(e->cfg.lut_filename))) {
+		av_free(e);
+		return NULL;
+	}
+	if(e->cfg.filter == PLAYER_FILTER_LUT && !e->lut) {
+		fprintf(stderr, "The LUT filter needs a LUT file\n");
+		av_free(e);
+		return NULL;
+	}
+	e->channels[0] = channel_create(e, primary, 0);
+	e->channels[1] = e->channels[0] ? channel_create(e, second, 1) : NULL;
+	if(!e->channels[1]) {
+		channel_free(e->channels[0]);
+		lut3d_free(&e->lut);
+		av_free(e);
+		return NULL;
+	}
+	e->channels[0]->is2 = e->channels[1];
+	e->audio_channel = e->channels[0];
+	e->loop_a = -1;
+	if(e->cfg.sync_lock && (e->screen || e->virtual_clock)) {
+		/* the master clock starts with the first picture */
+		e->sync_lock = 1;
+		e->channels[0]->av_sync_type = e->channels[1]->av_sync_type = AV_SYNC_EXTERNAL_MASTER;
+	}
+	if((e->screen && e->renderer->open && e->renderer->open(e) < 0) ||
+			(e->cfg.verify && !(e->verifier = verifier_open()))) {
+		channel_free(e->channels[0]);
+		channel_free(e->channels[1]);
+		lut3d_free(&e->lut);
+		av_free(e);
+		return NULL;
+	}
+
+	if(e->screen) {
+		stats_open(e);
+		stats_timer_start(e);
+	}
+
+	pthread_mutex_lock(&engines_mutex);
+	e->next = engines;
+	engines = e;
+	pthread_mutex_unlock(&engines_mutex);
+
+	for(c = 0; c < 2; c++) {
+		// an engine without display has no timers, but for the virtual ones
+		if(e->screen || e->virtual_clock)
+			schedule_refresh(e->channels[c], 40);
+		e->channels[c]->parse_tid = SDL_CreateThread(decode_thread, e->channels[c]);
+		if(!e->channels[c]->parse_tid) {
+			player_close(e);
+			return NULL;
+		}
+	}
+	return e;
+}
+
+void player_close(PlayerEngine *e) {
+
+	PlayerEngine **p;
+	VideoState *is;
+	int c;
+
+	pthread_mutex_lock(&engines_mutex);
+	for(p = &engines; *p && *p != e; p = &(*p)->next);
+	if(*p)
+		*p = e->next;
+	pthread_mutex_unlock(&engines_mutex);
+
+	stats_timer_stop(e);
+	if(e->recorder)
+		recorder_stop(e, 1);
+	recorder_join(e);
+	if(e->comparator)
+		compare_stop(e);
+	if(e->verifier)
+		verifier_abort(e->verifier);
+	for(c = 0; c < 2; c++)
+		channel_stop(e->channels[c]);
+	/* the audio callback is done with the channels once the device is closed */
+	if(e->audio_open)
+		SDL_CloseAudio();
+	for(c = 0; c < 2; c++) {
+		is = e->channels[c];
+		SDL_WaitThread(is->parse_tid, NULL);
+		SDL_WaitThread(is->video_tid, NULL);
+		SDL_WaitThread(is->playlist_tid, NULL);
+		if(is->color_started)
+			pthread_join(is->color_tid, NULL);
+		if(is->refresh_timer)
+			SDL_RemoveTimer(is->refresh_timer);
+	}
+	if(e->screen && e->renderer->close)
+		e->renderer->close(e);
+	if(e->verifier)
+		verifier_free(e->verifier);
+	for(c = 0; c < 2; c++)
+		channel_free(e->channels[c]);
+	stats_close(e);
+	if(e->virtual_clock) {
+		SDL_DestroyMutex(e->virtual_mutex);
+		SDL_DestroyCond(e->virtual_cond);
+	}
+	lut3d_free(&e->lut);
+	av_free(e);
+}
+
+int player_handle_event(SDL_Event *event, PlayerEngine **engine) {
+
+	VideoState *is = event->user.data1;
+	PlayerEngine *e;
+
+	if(event->type != FF_ALLOC_EVENT && event->type != FF_REFRESH_EVENT && event->type != FF_QUIT_EVENT &&
+			event->type != FF_PRESENT_EVENT && event->type != FF_STATS_EVENT)
+		return PLAYER_EVENT_NONE;
+	pthread_mutex_lock(&engines_mutex);
+	for(e = engines; e && e->channels[0] != is && e->channels[1] != is; e = e->next);
+	pthread_mutex_unlock(&engines_mutex);
+	if(engine)
+		*engine = e;
+	if(!e)
+		return PLAYER_EVENT_HANDLED;	/* left over from a closed engine */
+	switch(event->type) {
+	case FF_ALLOC_EVENT:
+		alloc_picture(is);
+		break;
+	case FF_REFRESH_EVENT:
+		is->refresh_timer = 0;
+		video_refresh_timer(is);
+		break;
+	case FF_STATS_EVENT:
+		if(e->stat_block)
+			stats_publish(e);
+		break;
+	case FF_PRESENT_EVENT:
+		e->present_pending = 0;
+		if(e->canvas)
+			canvas_compose(e);
+		break;
+	case FF_QUIT_EVENT:
+		return PLAYER_EVENT_QUIT;
+	}
+	return PLAYER_EVENT_HANDLED;
+}
+
+/* lock mode: both channels to 'pos', shown again together */
+static void sync_seek(PlayerEngine *e, double pos, int rel) {
+
+	VideoState *is;
+	int c;
+
+	for(c = 0; c < 2; c++) {
+		is = e->channels[c];
+		/* every picture waits until the demuxer tells which serial its
+		   seek gave, a pending seek included */
+		is->sync_serial = INT_MAX;
+		is->sync_held = 0;
+		is->sync_seek = 1;
+		stream_seek(is, (int64_t)(pos * AV_TIME_BASE), rel);
+	}
+	e->sync_barrier = 1;
+	e->sync_barrier_time = engine_time(e);
+}
+
+/* new loop points for the demuxer of the channel, b 0 for none */
+static void loop_request(VideoState *is, double a, double b) {
+
+	SDL_LockMutex(is->read_mutex);
+	is->loop_a = a;
+	is->loop_b = b;
+	is->loop_req = 1;
+	SDL_UnlockMutex(is->read_mutex);
+	demux_signal(is);
+}
+
+/* end the loop; with 'seek' the channel carries on from where it is,
+   else the caller seeks it */
+static void loop_stop(PlayerEngine *e, int seek) {
+
+	VideoState *is = e->loop_channel;
+	double pos;
+
+	if(!is)
+		return;
+	pos = get_master_clock(is);
+	loop_request(is, 0, 0);
+	if(seek)
+		stream_seek(is, (int64_t)(pos * AV_TIME_BASE), -1);
+	e->loop_channel = NULL;
+}
+
+void player_seek(PlayerEngine *e, double incr) {
+
+	VideoState *is = e->audio_channel;
+	double pos = get_master_clock(is) + incr;
+
+	loop_stop(e, e->loop_channel != is);
+	if(e->sync_lock)
+		sync_seek(e, pos, incr);
+	else
+		stream_seek(is, (int64_t)(pos * AV_TIME_BASE), incr);
+}
+
+/* the same filter again turns it off */
+void player_toggle_filter(PlayerEngine *e, int filter) {
+
+	VideoState *is = e->channels[0];
+
+	if(filter == PLAYER_FILTER_LUT && !e->lut) {
+		printf("No LUT loaded\n");
+		return;
+	}
+	if(is->color_flag == filter)
+		filter = PLAYER_FILTER_NONE;
+	is->color_flag = is->is2->color_flag = filter;
+}
+
+void player_screenshot(PlayerEngine *e) {
+
+	e->audio_channel->save_picture_flag = 1;
+}
+
+void player_select_audio(PlayerEngine *e, int channel) {
+
+	e->channels[0]->flag_sound = e->channels[1]->flag_sound = channel;
+	e->audio_channel = e->channels[channel == 2];
+}
+
+void player_toggle_mute(PlayerEngine *e) {
+
+	e->mute = !e->mute;
+}
+
+void player_show_both(PlayerEngine *e, int both) {
+
+	e->multi_videos = both;
+}
+
+void player_set_speed(PlayerEngine *e, double speed) {
+
+	VideoState *is;
+	int c;
+
+	if(e->headless)
+		return;
+	if(e->cfg.live) {
+		fprintf(stderr, "Live channels play at the speed they arrive\n");
+		return;
+	}
+	speed = av_clipd(speed, SPEED_MIN, SPEED_MAX);
+	if(speed == e->speed)
+		return;
+	/* the clocks go on from where they are, at the new rate; paused,
+	   they stand still and resuming rebases them anyway */
+	if(!e->paused) {
+		for(c = 0; c < 2; c++) {
+			is = e->channels[c];
+			if(is->video_current_pts_time) {
+				is->video_current_pts = get_video_clock(is);
+				is->video_current_pts_time = engine_time(e);
+			}
+		}
+	}
+	if(e->clock_time) {
+		e->clock_pts = get_external_clock(e->channels[0]);
+		e->clock_time = e->paused ? e->pause_time : engine_time(e);
+	}
+	e->speed = speed;
+	printf("Speed %gx\n", speed);
+}
+
+void player_change_speed(PlayerEngine *e, int steps) {
+
+	static const double speeds[] = { 0.5, 0.75, 1.0, 1.25, 1.5, 2.0, 3.0, 4.0 };
+	int i;
+
+	/* the step at or above the speed now, then 'steps' from there */
+	for(i = 0; i < FF_ARRAY_ELEMS(speeds) - 1 && speeds[i] < e->speed; i++)
+		;
+	if(steps > 0 && speeds[i] > e->speed)
+		steps--;
+	player_set_speed(e, speeds[av_clip(i + steps, 0, FF_ARRAY_ELEMS(speeds) - 1)]);
+}
+
+void player_toggle_fast(PlayerEngine *e) {
+
+	player_set_speed(e, e->speed == 1.0 ? 2.0 : 1.0);
+}
+
+/* restart the refresh of a channel the pause stopped */
+static void channel_refresh_restart(VideoState *is) {
+
+	if(is->refresh_stopped) {
+		is->refresh_stopped = 0;
+		push_refresh(is);
+	}
+}
+
+void player_toggle_sync_lock(PlayerEngine *e) {
+
+	int c;
+
+	if(!e->screen)
+		return;
+	e->sync_lock = !e->sync_lock;
+	for(c = 0; c < 2; c++) {
+		e->channels[c]->av_sync_type = e->sync_lock ? AV_SYNC_EXTERNAL_MASTER : DEFAULT_AV_SYNC_TYPE;
+		e->channels[c]->drift = e->channels[c]->drift_sum = e->channels[c]->drift_max = 0;
+		e->channels[c]->drift_count = 0;
+	}
+	if(e->sync_lock) {
+		/* the second channel goes where the primary is, both start together */
+		loop_stop(e, 0);
+		e->loop_a = -1;
+		e->clock_pts = get_video_clock(e->channels[0]);
+		e->clock_time = e->paused ? e->pause_time : engine_time(e);
+		sync_seek(e, e->clock_pts, -1);
+	}
+	else
+		e->sync_barrier = 0;
+	printf("Sync lock %s\n", e->sync_lock ? "on" : "off");
+}
+
+void player_set_loop_a(PlayerEngine *e) {
+
+	if(!e->screen)
+		return;
+	if(e->sync_lock) {
+		printf("No A-B loop in lock mode\n");
+		return;
+	}
+	e->loop_a = get_master_clock(e->audio_channel);
+	printf("Loop A at %.2f\n", e->loop_a);
+}
+
+void player_set_loop_b(PlayerEngine *e) {
+
+	VideoState *is = e->audio_channel;
+	double b;
+
+	if(!e->screen || e->sync_lock)
+		return;
+	b = get_master_clock(is);
+	if(e->loop_a < 0 || b < e->loop_a + LOOP_MIN_LENGTH) {
+		printf("Set A before B\n");
+		return;
+	}
+	if(e->loop_channel != is)
+		loop_stop(e, 1);
+	e->loop_channel = is;
+	loop_request(is, e->loop_a, b);
+	printf("Loop %.2f - %.2f\n", e->loop_a, b);
+}
+
+void player_clear_loop(PlayerEngine *e) {
+
+	if(!e->loop_channel && e->loop_a < 0)
+		return;
+	loop_stop(e, 1);
+	e->loop_a = -1;
+	printf("Loop off\n");
+}
+
+void player_sync_drift(PlayerEngine *e, double drift[2]) {
+
+	int c;
+
+	for(c = 0; c < 2; c++)
+		drift[c] = e->sync_lock ? e->channels[c]->drift : 0;
+}
+
+void player_toggle_pause(PlayerEngine *e) {
+
+	VideoState *is;
+	int64_t now = engine_time(e);
+	int c;
+
+	if(!e->screen)
+		return;
+	e->paused = !e->paused;
+	if(e->audio_open)
+		SDL_PauseAudio(e->paused);
+	if(e->paused) {
+		e->pause_time = now;
+		if(e->stat_block)
+			stats_publish(e);
+		stats_timer_stop(e);
+		return;
+	}
+	stats_timer_start(e);
+	/* the clocks stood still: pick up where we were, no catch-up burst */
+	if(e->clock_time)
+		e->clock_time += now - e->pause_time;
+	for(c = 0; c < 2; c++) {
+		is = e->channels[c];
+		is->frame_timer += (now - e->pause_time) / 1000000.0;
+		is->video_current_pts_time = now;
+		is->step = 0;
+		SDL_LockMutex(is->colorq_mutex);
+		SDL_CondBroadcast(is->colorq_cond);	/* keep-up mode waits on the clock */
+		SDL_UnlockMutex(is->colorq_mutex);
+		if(e->cfg.live)
+			is->live_started = 0;	/* what arrived meanwhile is late: find the latency again */
+		channel_refresh_restart(is);
+	}
+}
+
+void player_step(PlayerEngine *e) {
+
+	int c;
+
+	if(!e->screen)
+		return;
+	if(!e->paused)
+		player_toggle_pause(e);
+	for(c = 0; c < 2; c++) {
+		e->channels[c]->step = 1;
+		channel_refresh_restart(e->channels[c]);
+	}
+}
+
+void player_toggle_recording(PlayerEngine *e) {
+
+	if(!e->screen)
+		return;
+	if(!e->recorder)
+		e->recorder = recorder_start(e->channels[0]);
+	else
+		recorder_stop(e, 0);
+}
+
+/* the same view again goes back to both channels stacked */
+void player_set_view(PlayerEngine *e, int view) {
+
+	if(!e->canvas) {
+		printf("Comparison views need the canvas renderer\n");
+		return;
+	}
+	e->view = e->view == view ? PLAYER_VIEW_STACKED : view;
+	e->view_dirty = 1;
+	canvas_request(e);	/* shown at once, paused too */
+}
+
+void player_move_wipe(PlayerEngine *e, double delta) {
+
+	e->wipe_pos = av_clipf(e->wipe_pos + delta, 0, 1);
+	e->view_dirty = 1;
+	canvas_request(e);
+}
+
+void player_toggle_compare(PlayerEngine *e) {
+
+	if(!e->screen)
+		return;
+	if(!e->comparator)
+		e->comparator = compare_start(e);
+	else
+		compare_stop(e);
+}
+
+void player_print_stats(PlayerEngine *e) {
+
+	print_stats(e->channels[0]);
+	if(e->comparator)
+		compare_print_stats(e->comparator);
+}
+
+int player_export(PlayerEngine *e) {
+
+	return export_run(e->channels[0], e->cfg.width, e->cfg.height);
+}
@@ -0,0 +1,178 @@
+/***
+ *  libplayer - the two channel playback engine of the player
+ *
+ *  An engine plays a primary and a second channel (media file, playlist
+ *  or directory each) with its own threads, queues, clocks, filters,
+ *  recorder and exporter. One process can open several engines, but they
+ *  are not independent: this state is process-wide, shared by all of them
+ *  and guarded for it:
+ *    - the color filter worker threads and the marker packets the queues
+ *      carry, set up by player_init;
+ *    - the probe cache of the opened files;
+ *    - the allocation counters, so the per-engine reports of
+ *      player_print_stats count the pictures of every engine;
+ *    - the memory budget (player_set_mem_budget), one for all channels;
+ *    - the list of open engines that player_handle_event searches.
+ *
+ *  SDL 1.2 has a single window and a single audio device per process: an
+ *  engine draws on the surface it is given (none for headless engines)
+ *  and only one engine at a time holds the audio device; one opened while
+ *  another has it plays without sound.
+ */
+
+#ifndef PLAYER_H
+#define PLAYER_H
+
+#include <stdint.h>
+#include <SDL.h>
+
+typedef struct PlayerEngine PlayerEngine;
+
+/* color filters, in the order of the -filter names */
+enum {
+	PLAYER_FILTER_NONE,
+	PLAYER_FILTER_BW,
+	PLAYER_FILTER_RED,
+	PLAYER_FILTER_GREEN,
+	PLAYER_FILTER_BLUE,
+	PLAYER_FILTER_YUV,
+	PLAYER_FILTER_LUT,
+};
+
+/* how the pictures get on the screen */
+enum {
+	PLAYER_RENDERER_CANVAS,	// every tile scaled into one screen overlay, one present
+	PLAYER_RENDERER_OVERLAY,	// an overlay per picture, presented per channel
+};
+
+/* what the screen shows */
+enum {
+	PLAYER_VIEW_STACKED,	// both channels, each in its tile
+	PLAYER_VIEW_DIFF,	// absolute difference of the two, amplified
+	PLAYER_VIEW_WIPE,	// primary left of a divider, second right of it
+	PLAYER_VIEW_CHECKER,	// checkerboard of the two
+};
+
+/* what player_handle_event did with an event */
+enum {
+	PLAYER_EVENT_NONE,	// not an engine event
+	PLAYER_EVENT_HANDLED,
+	PLAYER_EVENT_QUIT,	// a channel of the engine stopped: close it
+};
+
+typedef struct PlayerConfig {
+	int64_t         probe_size;	// bytes probed, 0 keeps the libavformat default
+	int64_t         analyze_duration;	// microseconds analyzed, 0 keeps the default
+	int             fast_start;	// minimal probing, let the decoders find the rest
+	int             live;	// network sources played at a fixed latency behind arrival
+	double          latency;	// live: seconds between packet arrival and display
+	const char      *lut_filename;	// .cube file for PLAYER_FILTER_LUT
+	int             filter;	// color filter at start
+	int             width, height;	// output size (window or export)
+	int             renderer;	// PLAYER_RENDERER_*
+	int             sync_lock;	// start in lock mode (see player_toggle_sync_lock)
+	int             intra_decoders;	// intra-only video decoded in parallel: -1 one decoder per core, 0 off
+	int             audio_device;	// play the audio on the SDL audio device
+	const char      *export_filename;	// render to this file instead of playing
+	int             export_audio;	// audio of the export: 1 primary, 2 second, 0 none
+	const char      *encoder_preset;	// exports and recordings
+	int             encoder_threads;	// 0: one per core
+	const char      *record_format;	// container of the recordings
+	int             verify;	// hash every decoded picture instead of playing
+	const char      *verify_filename;	// verify: where the hashes go, "-" for stdout
+	const char      *golden_filename;	// verify: hashes to check against
+	const char      *virtual_filename;	// play on a virtual clock, log the sync to this file ("-" for stdout)
+	double          speed;	// times the media rate at start (see player_set_speed)
+}PlayerConfig;
+
+/* Once per process, before the first engine: registers the codecs and
+   starts 'nb_threads' color filter workers (-1: one per core besides the
+   caller). */
+int player_init(int nb_threads);
+void player_uninit(void);
+
+/* Bytes every engine of the process shares for its packet queues,
+   pictures, audio buffers and caches (-membudget); 0, the default, keeps
+   the fixed queue caps. */
+void player_set_mem_budget(int64_t bytes);
+
+void player_config_defaults(PlayerConfig *cfg);
+
+/* Open both channels and start playing; 'screen' is where the pictures
+   go, NULL for an engine without display. */
+PlayerEngine *player_open(const PlayerConfig *cfg, const char *primary, const char *second, SDL_Surface *screen);
+
+/* Stop every thread of the engine and free it. */
+void player_close(PlayerEngine *e);
+
+/* The engines post their refresh, allocation and quit events on the SDL
+   event queue; the application hands every event it gets to this.
+   'engine' is set to the engine the event was for. */
+int player_handle_event(SDL_Event *event, PlayerEngine **engine);
+
+/* Controls. The channel being heard is the one seeks and screenshots
+   apply to. */
+void player_seek(PlayerEngine *e, double incr);
+void player_toggle_filter(PlayerEngine *e, int filter);
+void player_screenshot(PlayerEngine *e);
+void player_select_audio(PlayerEngine *e, int channel);
+void player_toggle_mute(PlayerEngine *e);
+void player_show_both(PlayerEngine *e, int both);
+/* Play both channels 'speed' times faster, from 0.5 to 4, the sound
+   time-stretched to keep its pitch and the video paced to follow it.
+   player_change_speed goes 'steps' up or down the steps 0.5, 0.75, 1,
+   1.25, 1.5, 2, 3 and 4; player_toggle_fast goes between 1 and 2. Live
+   channels only play at 1. */
+void player_set_speed(PlayerEngine *e, double speed);
+void player_change_speed(PlayerEngine *e, int steps);
+void player_toggle_fast(PlayerEngine *e);
+/* Pause and resume both channels; while paused no thread of the engine
+   runs and no timer fires. A step shows the next picture of each channel
+   and pauses if needed. */
+void player_toggle_pause(PlayerEngine *e);
+void player_step(PlayerEngine *e);
+/* Lock mode: one master clock drives the video and the audio of both
+   channels, and seeks go to both, which show their first picture after
+   it together. player_sync_drift gives the seconds each channel's last
+   picture was ahead of the master clock (0 when not locked). */
+void player_toggle_sync_lock(PlayerEngine *e);
+void player_sync_drift(PlayerEngine *e, double drift[2]);
+/* A-B loop of the channel being heard: A and B are marked where it is,
+   and B starts the loop with a seek back to A. The segment is read once;
+   its packets, and its pictures when they fit in the memory budget, are kept
+   so that the repeats start at once with no seek and no demuxing. Seeks
+   and clearing end the loop. Not in lock mode. */
+void player_set_loop_a(PlayerEngine *e);
+void player_set_loop_b(PlayerEngine *e);
+void player_clear_loop(PlayerEngine *e);
+void player_toggle_recording(PlayerEngine *e);
+/* A/B views of the two channels, full screen; canvas renderer only. The
+   wipe divider moves by 'delta' of the width. */
+void player_set_view(PlayerEngine *e, int view);
+void player_move_wipe(PlayerEngine *e, double delta);
+/* PSNR and SSIM of the second channel against the primary, per plane,
+   on pictures of the same pts: shown in the window caption and logged to
+   a new CSV file. Pairs are skipped rather than slowing playback down. */
+void player_toggle_compare(PlayerEngine *e);
+void player_print_stats(PlayerEngine *e);
+
+/* Engine opened with an export_filename: render everything, then return
+   0 on success. */
+int player_export(PlayerEngine *e);
+
+/* Engine opened with verify set: decode everything as fast as possible and
+   hash every picture, then write and/or check the hashes. Returns 0 when
+   every picture matches the golden file (or when there is none). */
+int player_verify(PlayerEngine *e);
+
+/* Engine opened with a virtual_filename: play everything on a virtual
+   clock, advanced from the picture and sample timestamps instead of the
+   wall clock, as fast as the decoders go. The refreshes and the audio
+   sync make the same decisions on every run; each one is logged. */
+int player_simulate(PlayerEngine *e);
+
+/* Measure the color filter throughput on a synthetic picture for 1 up to
+   one thread per core and print the scaling curve. */
+int player_bench_filter(const PlayerConfig *cfg, int width, int height);
+
+#endif
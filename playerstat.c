@@ -0,0 +1,142 @@
+/***
+ *  Unix Programming - Project 2
+ *
+ *  Special two channel video player based on FFMPEG and SDL
+ *  Made by Yoav Saroya (304835887) & Amit Shmuel (305213621)
+ *
+ *  playerstat: prints the statistics the running players publish in
+ *  shared memory (playerstat.h), once or every few milliseconds. It
+ *  never talks to a player and a player never waits for it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "playerstat.h"
+
+#define SHM_DIR "/dev/shm"
+
+static int64_t now_us(void) {
+
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void print_block(const char *name, const PlayerStatBlock *b) {
+
+	const PlayerStatChannel *c;
+	int i;
+
+	printf("%s: pid %d%s, %s at %gx%s, ", name, b->pid, kill(b->pid, 0) < 0 && errno == ESRCH ? " (gone)" : "",
+			b->paused ? "paused" : "playing", b->speed, b->sync_lock ? ", lock mode" : "");
+	if(!b->updates) {
+		printf("nothing shown yet\n");
+		return;
+	}
+	printf("updated %.1f s ago (%lld updates)\n", (now_us() - b->update_time) / 1000000.0, (long long)b->updates);
+	for(i = 0; i < 2; i++) {
+		c = &b->channels[i];
+		printf("  Channel %d %s at %.2f s\n", i + 1, c->filename, c->clock);
+		printf("    queues: audio %d packets %d KB, video %d packets %d KB, pictures %d, color %d\n",
+				c->audioq_packets, c->audioq_bytes >> 10, c->videoq_packets, c->videoq_bytes >> 10,
+				c->pictq_size, c->colorq_size);
+		printf("    %.1f fps, %lld pictures, %d dropped, %d late, underruns %d audio %d video, "
+				"A/V %+.1f ms, drift %+.1f ms\n",
+				c->fps, (long long)c->pictures, c->dropped, c->late, c->audio_underruns, c->video_underruns,
+				c->av_diff * 1000, c->drift * 1000);
+	}
+}
+
+/* print one block; returns -1 when it is not a player block we can read */
+static int show(const char *name) {
+
+	char path[300];
+	PlayerStatBlock *b, copy;
+	int fd, tries, ret = -1;
+
+	snprintf(path, sizeof(path), "/%s", name);
+	fd = shm_open(path, O_RDONLY, 0);
+	if(fd < 0)
+		return -1;
+	b = mmap(NULL, sizeof(PlayerStatBlock), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(b == MAP_FAILED)
+		return -1;
+	if(b->magic != PLAYERSTAT_MAGIC)
+		fprintf(stderr, "%s: not a player statistics block (yet)\n", name);
+	else if(b->version != PLAYERSTAT_VERSION || b->size != sizeof(PlayerStatBlock))
+		fprintf(stderr, "%s: version %u, this playerstat reads version %d\n", name, b->version, PLAYERSTAT_VERSION);
+	else {
+		/* the writer updates in bursts: give it a moment between tries */
+		for(tries = 0; tries < 10 && playerstat_read(b, &copy) < 0; tries++)
+			usleep(1000);
+		if(tries == 10)
+			fprintf(stderr, "%s: always being updated, try again\n", name);
+		else {
+			print_block(name, &copy);
+			ret = 0;
+		}
+	}
+	munmap(b, sizeof(PlayerStatBlock));
+	return ret;
+}
+
+/* every block in SHM_DIR, or those of one pid; returns how many were shown */
+static int show_all(int pid) {
+
+	DIR *dir = opendir(SHM_DIR);
+	struct dirent *entry;
+	char prefix[64];
+	int n = 0;
+
+	if(!dir) {
+		fprintf(stderr, "Could not list %s\n", SHM_DIR);
+		return 0;
+	}
+	if(pid > 0)
+		snprintf(prefix, sizeof(prefix), PLAYERSTAT_PREFIX "%d-", pid);
+	else
+		snprintf(prefix, sizeof(prefix), PLAYERSTAT_PREFIX);
+	while((entry = readdir(dir))) {
+		if(!strncmp(entry->d_name, prefix, strlen(prefix)) && show(entry->d_name) == 0)
+			n++;
+	}
+	closedir(dir);
+	return n;
+}
+
+int main(int argc, char *argv[]) {
+
+	int i, pid = 0, interval = 0;
+
+	for(i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "-w") && i + 1 < argc)
+			interval = strtol(argv[++i], NULL, 10);
+		else if(argv[i][0] != '-')
+			pid = strtol(argv[i], NULL, 10);
+		else {
+			fprintf(stderr, "usage: %s [-w <ms>] [pid]\n", argv[0]);
+			return 1;
+		}
+	}
+	for(;;) {
+		if(!show_all(pid) && !interval) {
+			fprintf(stderr, "No player is running\n");
+			return 1;
+		}
+		if(interval <= 0)
+			return 0;
+		usleep(interval * 1000);
+		printf("\n");
+	}
+}
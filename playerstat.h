@@ -0,0 +1,88 @@
+/***
+ *  playerstat - the statistics a player publishes for monitoring
+ *
+ *  Every engine with a display publishes its queue depths, rates, drops,
+ *  underruns and A/V drift in a POSIX shared memory block named after the
+ *  process and the engine (PLAYERSTAT_NAME), where the playerstat tool or
+ *  any other monitor reads them without talking to the player.
+ *
+ *  The block is a seqlock: its only writer, the event thread of the
+ *  engine, makes the sequence number odd, updates the block and makes it
+ *  even again, so it never waits. A reader copies the block and keeps the
+ *  copy if the sequence number was even and the same before and after.
+ */
+
+#ifndef PLAYERSTAT_H
+#define PLAYERSTAT_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define PLAYERSTAT_MAGIC 0x54534c50	/* "PLST" */
+#define PLAYERSTAT_VERSION 2	/* bumped whenever the layout changes */
+#define PLAYERSTAT_NAME "/player-%d-%d"	/* shm_open name: pid, engine */
+#define PLAYERSTAT_PREFIX "player-"	/* the blocks in /dev/shm */
+#define PLAYERSTAT_READ_TRIES 1000	/* copies a reader tries before giving up */
+
+typedef struct PlayerStatChannel {
+	char            filename[256];	// item being played
+	int32_t         audioq_packets, videoq_packets;
+	int32_t         audioq_bytes, videoq_bytes;
+	int32_t         pictq_size, colorq_size;
+	int64_t         pictures;	// out of the video thread (decoded, or kept by an A-B loop), since the start
+	double          fps;	// of those, per second over the last update interval
+	int32_t         dropped;	// pictures never shown (live mode)
+	int32_t         late;	// pictures shown after their time
+	int32_t         audio_underruns;	// the audio device got silence, nothing was decoded
+	int32_t         video_underruns;	// a picture was due, none was ready
+	double          clock;	// seconds, master clock of the channel
+	double          av_diff;	// seconds the audio clock is ahead of the video clock
+	double          drift;	// lock mode: seconds ahead of the master clock
+}PlayerStatChannel;
+
+typedef struct PlayerStatBlock {
+	uint32_t        magic;
+	uint32_t        version;
+	uint32_t        size;	// sizeof(PlayerStatBlock) for the writer
+	volatile uint32_t seq;	// odd while the writer is updating the block
+	int32_t         pid;
+	int32_t         paused, sync_lock;
+	double          speed;	// times the media rate
+	int64_t         update_time;	// microseconds since the epoch of the last update
+	int64_t         updates;
+	PlayerStatChannel channels[2];	// primary and second channel
+}PlayerStatBlock;
+
+static inline void playerstat_write_begin(PlayerStatBlock *b) {
+
+	b->seq++;
+	__sync_synchronize();
+}
+
+static inline void playerstat_write_end(PlayerStatBlock *b) {
+
+	__sync_synchronize();
+	b->seq++;
+}
+
+/* copy a consistent snapshot of the block; -1 if every try met the
+   writer in the middle of an update */
+static inline int playerstat_read(const PlayerStatBlock *b, PlayerStatBlock *copy) {
+
+	uint32_t seq;
+	int i;
+
+	for(i = 0; i < PLAYERSTAT_READ_TRIES; i++) {
+		seq = b->seq;
+		__sync_synchronize();
+		if(seq & 1)
+			continue;
+		memcpy(copy, (const void *)b, sizeof(*copy));
+		__sync_synchronize();
+		if(b->seq == seq)
+			return 0;
+	}
+	return -1;
+}
+
+#endif